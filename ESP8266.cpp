@@ -44,11 +44,12 @@
 #ifdef ESP8266_USE_SOFTWARE_SERIAL
 ESP8266::ESP8266(SoftwareSerial &uart, uint32_t baud): m_puart(&uart)
 {
-
+  m_baud = baud;
 }
 #else
 ESP8266::ESP8266(HardwareSerial &uart, uint32_t baud): m_puart(&uart)
 {
+  m_baud = baud;
   m_puart->begin(baud);
   rx_empty();
 }
@@ -67,14 +68,14 @@ bool ESP8266::autoSetBaud(uint32_t baudRateSet)
 #endif
 
   for (int j = 0 ; j < attempts ; j++) {                    //attempt to connect to esp over each baudrate
-    for (int i = 0; i < sizeof(baudRateArray) ; i++)        //check for current esp baudrate
+    for (int i = 0; i < (int)(sizeof(baudRateArray) / sizeof(baudRateArray[0])) ; i++)        //check for current esp baudrate
     {
       m_puart->begin(baudRateArray[i]);
 
-      m_puart->println("AT");
+      m_tx.println("AT");
       delay(20);
-      while (m_puart->available()) {
-        String inData = m_puart->readStringUntil('\n');
+      while (rx_available()) {
+        String inData = rx_readStringUntil('\n');
         if (inData.indexOf("OK") != -1) {       //if OK received, this is the current baudrate of the ESP
           baudFlag = 1;
           delay(15);
@@ -90,14 +91,15 @@ bool ESP8266::autoSetBaud(uint32_t baudRateSet)
       baudFlag = 0;
       for (int j = 0; j < attempts; j++)               //at the found baudrate,
       {
-        m_puart->print("AT+CIOBAUD=");
-        m_puart->println(baudRateSet);
+        m_tx.print("AT+CIOBAUD=");
+        m_tx.println(baudRateSet);
         delay(20);
-        while (m_puart->available()) {
-          String inData = m_puart->readStringUntil('\n');
+        while (rx_available()) {
+          String inData = rx_readStringUntil('\n');
           if (inData.indexOf("OK") != -1 || inData.indexOf("AT") != -1) {
             baudFlag = 1;
             m_puart->begin(baudRateSet);
+            m_baud = baudRateSet;
             delay(100);
             return 1;
           }
@@ -127,6 +129,9 @@ bool ESP8266::init(const String &ssid, const String &pwd, uint32_t baudRateSet)
     Serial.println("Baudrate set failed");
     return false;
   }
+  if (!(m_caps & ESP8266_CAP_PROBED)) {
+    probeCapabilities();
+  }
 
   //Setting operation mode to Station + SoftAP
   if (setOprToStationSoftAP())
@@ -139,6 +144,12 @@ bool ESP8266::init(const String &ssid, const String &pwd, uint32_t baudRateSet)
     return false;
   }
 
+  if (!applyStaticIP())
+  {
+    Serial.println("Static IP - Error, Reset Board!");
+    return false;
+  }
+
   if (joinAP(ssid, pwd))
   {
     Serial.print("Joining AP successful, ");
@@ -162,6 +173,65 @@ bool ESP8266::init(const String &ssid, const String &pwd, uint32_t baudRateSet)
   return true;
 }
 
+bool ESP8266::fastInit(const String &ssid, const String &pwd, uint32_t baudRateSet)
+{
+  unsigned long start = millis();
+  unsigned long step = start;
+  uint8_t value;
+  String joined;
+
+  memset(&m_bootTiming, 0, sizeof(m_bootTiming));
+
+#ifndef ESP8266_USE_SOFTWARE_SERIAL
+  baudRateSet = 115200;                         //same rate autoSetBaud would choose
+#endif
+  m_puart->begin(baudRateSet);
+  m_baud = baudRateSet;
+  if (eAT()) {
+    m_bootTiming.skipped |= 1;
+  } else if (!autoSetBaud(baudRateSet)) {
+    return false;
+  }
+  if (!(m_caps & ESP8266_CAP_PROBED)) {
+    probeCapabilities();
+  }
+  m_bootTiming.baud = millis() - step;
+  step = millis();
+
+  if (qATCWMODE(&value) && value == 3) {
+    m_bootTiming.skipped |= 2;
+  } else if (!setOprToStationSoftAP()) {
+    return false;
+  }
+  m_bootTiming.mode = millis() - step;
+  step = millis();
+
+  if (!applyStaticIP()) {
+    return false;
+  }
+  /* STATUS:2 got IP, 3 connected, 4 disconnected - all mean the station has an address */
+  if (qATCIPSTATUS(&value) && value >= 2 && value <= 4 && qATCWJAP(joined) && joined == ssid) {
+    m_bootTiming.skipped |= 4;
+  } else if (!joinAP(ssid, pwd)) {
+    return false;
+  }
+  m_bootTiming.join = millis() - step;
+  step = millis();
+
+  if (qATCIPMUX(&value) && value == 0) {
+    m_bootTiming.skipped |= 8;
+  } else if (!sATCIPMUX(0)) {
+    return false;
+  }
+  m_bootTiming.mux = millis() - step;
+  m_bootTiming.total = millis() - start;
+  return true;
+}
+
+ESP8266BootTiming ESP8266::getBootTiming(void)
+{
+  return m_bootTiming;
+}
 
 bool ESP8266::kick(void)
 {
@@ -170,93 +240,97 @@ bool ESP8266::kick(void)
 
 bool ESP8266::restart(void)
 {
-  unsigned long start;
-  if (eATRST()) {
-    delay(2000);
-    start = millis();
-    while (millis() - start < 3000) {
-      if (eAT()) {
-        delay(1500); /* Waiting for stable */
-        return true;
-      }
-      delay(100);
-    }
-  }
-  return false;
+  cacheDrop(ESP8266_CACHE_ALL);
+  m_initPhase = 0;
+  return eATRST() && recvReady(5000);
 }
 
 String ESP8266::getVersion(void)
 {
-  rx_empty();
+  String version;
+  eATGMR(version);
+  return version;
+}
 
-  String inData;
-  m_puart->println("AT+GMR");
-  delay(50);
-  while (m_puart->available() > 0) {
-    inData = m_puart->readString();
-    delay(50);
-    if (inData.indexOf("version") != -1) {
+uint8_t ESP8266::probeCapabilities(void)
+{
+  String version;
+  uint8_t caps = ESP8266_CAP_PROBED;
 
-      return inData.substring(6);    //cut version out of string
-    }
+  if (!eATGMR(version)) {
+    return m_caps;
+  }
+  if (qATSupported("AT+CWMODE_CUR?")) {
+    caps |= ESP8266_CAP_CUR;
   }
-  return inData;
+  if (qATSupported("AT+CIPRECVMODE?")) {
+    caps |= ESP8266_CAP_CIPRECVMODE;
+  }
+  if (qATSupported("AT+UART_CUR?")) {
+    caps |= ESP8266_CAP_UART_CUR;
+  }
+  m_caps = caps;
+  return m_caps;
+}
+
+uint8_t ESP8266::getCapabilities(void)
+{
+  return m_caps;
+}
 
+void ESP8266::setCapabilities(uint8_t caps)
+{
+  m_caps = caps;
+}
 
-  String version;
-  eATGMR(version);
-  return version;
+bool ESP8266::hasCapability(uint8_t cap)
+{
+  return (m_caps & cap) != 0;
 }
 
 bool ESP8266::setOprToStation(void)
 {
-  uint8_t mode;
-  if (!qATCWMODE(&mode)) {
-    return false;
-  }
-  if (mode == 1) {
-    return true;
-  } else {
-    if (sATCWMODE(1) && restart()) {
-      return true;
-    } else {
-      return false;
-    }
-  }
+  return setOprMode(1);
 }
 
 bool ESP8266::setOprToSoftAP(void)
 {
-  uint8_t mode;
-  if (!qATCWMODE(&mode)) {
-    return false;
-  }
-  if (mode == 2) {
-    return true;
-  } else {
-    if (sATCWMODE(2) && restart()) {
-      return true;
-    } else {
-      return false;
-    }
-  }
+  return setOprMode(2);
 }
 
 bool ESP8266::setOprToStationSoftAP(void)
 {
-  uint8_t mode;
-  if (!qATCWMODE(&mode)) {
+  return setOprMode(3);
+}
+
+bool ESP8266::setOprMode(uint8_t mode)
+{
+  uint8_t current;
+  bool ok = false;
+  if (!qATCWMODE(&current)) {
     return false;
   }
-  if (mode == 3) {
+  if (current == mode) {
     return true;
-  } else {
-    if (sATCWMODE(3) && restart()) {
-      return true;
-    } else {
+  }
+  if (m_caps & ESP8266_CAP_CUR) {
+    ok = sATCWMODECUR(mode);
+    if (!ok && (m_caps & ESP8266_CAP_PROBED)) {
       return false;
     }
+    if (!ok) {
+      m_caps &= ~ESP8266_CAP_CUR;
+    }
+  }
+  if (!ok) {
+    ok = sATCWMODE(mode) && restart();
+  }
+  if (ok) {
+    cacheDrop(ESP8266_CACHE_ADDR | ESP8266_CACHE_AP);
+    m_cacheMode = mode;
+    m_cacheValid |= ESP8266_CACHE_MODE;
   }
+  return ok;
 }
 
 String ESP8266::getAPList(void)
@@ -271,6 +345,175 @@ bool ESP8266::joinAP(String ssid, String pwd)
   return sATCWJAP(ssid, pwd);
 }
 
+/* FNV-1a folded to 16 bits */
+static uint16_t ssidHash(const String &ssid)
+{
+  uint32_t h = 2166136261UL;
+  for (unsigned int i = 0; i < ssid.length(); i++) {
+    h ^= (uint8_t)ssid[i];
+    h *= 16777619UL;
+  }
+  return (uint16_t)(h ^ (h >> 16));
+}
+
+/* "aa:bb:cc:dd:ee:ff" */
+static bool parseMAC(const String &text, uint8_t *mac)
+{
+  if (text.length() != 17) {
+    return false;
+  }
+  for (uint8_t i = 0; i < 6; i++) {
+    char hex[3] = {text[i * 3], text[i * 3 + 1], '\0'};
+    char *end;
+    mac[i] = (uint8_t)strtoul(hex, &end, 16);
+    if (end != hex + 2 || (i < 5 && text[i * 3 + 2] != ':')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* The next comma separated field from index, without quotes; commas in quotes are kept */
+static String nextField(const String &line, int &index)
+{
+  String field;
+  bool quoted = false;
+  while (index < (int)line.length()) {
+    char c = line[index++];
+    if (c == '"') {
+      quoted = !quoted;
+    } else if (c == ',' && !quoted) {
+      break;
+    } else {
+      field += c;
+    }
+  }
+  return field;
+}
+
+/* The default AT+CWLAPOPT masks: every field */
+#define CWLAP_MASK_ALL  0x7FF
+#define CWLAP_MASK_OLD  0x7F
+
+/* +CWLAP:(<ecn>,<rssi>,"<mac>",<ch>) after AT+CWLAPOPT, else +CWLAP:(<ecn>,"<ssid>",<rssi>,"<mac>",<ch>,...) */
+uint8_t ESP8266::findAP(const String &ssid, ESP8266AP *list, uint8_t size)
+{
+  String data;
+  String line;
+  ESP8266AP ap;
+  bool opt;
+  int index1 = 0;
+  int index2;
+  int field;
+  uint8_t count = 0;
+  uint8_t i;
+
+  if (list == NULL || size == 0) {
+    return 0;
+  }
+  /* sorted by RSSI, fields ecn, rssi, mac and channel; set back after the scan */
+  opt = sATCWLAPOPT(1, 0x1D);
+  rx_empty();
+  m_tx.print("AT+CWLAP=\"");
+  m_tx.print(ssid);
+  m_tx.println("\"");
+  data = recvString("OK", "ERROR", 10000);
+  if (opt && !sATCWLAPOPT(0, CWLAP_MASK_ALL)) {
+    /* older firmware knows 7 fields only */
+    sATCWLAPOPT(0, CWLAP_MASK_OLD);
+  }
+
+  while ((index1 = data.indexOf("+CWLAP:(", index1)) != -1) {
+    index1 += 8;
+    index2 = data.indexOf(')', index1);
+    if (index2 == -1) {
+      break;
+    }
+    line = data.substring(index1, index2);
+    field = 0;
+    ap.ecn = nextField(line, field).toInt();
+    if (!opt) {
+      nextField(line, field);
+    }
+    ap.rssi = nextField(line, field).toInt();
+    if (!parseMAC(nextField(line, field), ap.bssid)) {
+      continue;
+    }
+    ap.channel = nextField(line, field).toInt();
+
+    /* insert by RSSI, dropping the weakest when list is full */
+    for (i = count; i > 0 && list[i - 1].rssi < ap.rssi; i--) {
+      if (i < size) {
+        list[i] = list[i - 1];
+      }
+    }
+    if (i < size) {
+      list[i] = ap;
+      if (count < size) {
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+bool ESP8266::joinAPFast(const String &ssid, const String &pwd)
+{
+  unsigned long start = millis();
+  uint16_t hash = ssidHash(ssid);
+  uint16_t *path = &m_joinStats.full;
+  uint32_t latency;
+  ESP8266AP ap;
+  bool ok = false;
+
+  if (m_fastJoin.channel != 0 && m_fastJoin.ssid_hash == hash) {
+    path = &m_joinStats.fast;
+    ok = sATCWJAP(ssid, pwd, m_fastJoin.bssid);
+    if (!ok && findAP(ssid, &ap, 1) > 0 && memcmp(ap.bssid, m_fastJoin.bssid, 6) != 0) {
+      /* the remembered AP is gone or weak, another one serves the SSID */
+      path = &m_joinStats.scanned;
+      ok = sATCWJAP(ssid, pwd, ap.bssid);
+    }
+  }
+  if (!ok) {
+    path = &m_joinStats.full;
+    ok = sATCWJAP(ssid, pwd);
+  }
+  if (!ok) {
+    m_joinStats.failed++;
+    m_fastJoin.channel = 0;
+    return false;
+  }
+
+  latency = millis() - start;
+  (*path)++;
+  m_joinStats.last_latency = latency;
+  if (latency > m_joinStats.max_latency) {
+    m_joinStats.max_latency = latency;
+  }
+  if (qATCWJAP(&ap)) {
+    memcpy(m_fastJoin.bssid, ap.bssid, 6);
+    m_fastJoin.channel = ap.channel;
+    m_fastJoin.ssid_hash = hash;
+  }
+  return true;
+}
+
+ESP8266FastJoin ESP8266::getFastJoin(void)
+{
+  return m_fastJoin;
+}
+
+void ESP8266::setFastJoin(const ESP8266FastJoin &record)
+{
+  m_fastJoin = record;
+}
+
+ESP8266JoinStats ESP8266::getJoinStats(void)
+{
+  return m_joinStats;
+}
+
 bool ESP8266::leaveAP(void)
 {
   return eATCWQAP();
@@ -297,39 +540,86 @@ String ESP8266::getIPStatus(void)
 
 String ESP8266::getLocalIP(void)
 {
+  if (!cacheGet(ESP8266_CACHE_ADDR) && !cacheAddr()) {
+    return "Couldn't get IP adress";
+  }
+  return String("IP: ") + m_cacheIP;
+}
 
-  String inData;
+String ESP8266::getLocalMAC(void)
+{
+  if (!cacheGet(ESP8266_CACHE_ADDR) && !cacheAddr()) {
+    return "";
+  }
+  return m_cacheMAC;
+}
 
-  rx_empty();
-  m_puart->println("AT+CIFSR");
-  delay(50);
-  while (m_puart->available() > 0) {
-    inData = m_puart->readStringUntil('\n');
-    if (inData.indexOf("IP") != -1) {
-      delay(100);
-      return ("IP: " + inData.substring( inData.indexOf("IP") + 4, inData.length() - 2 ));
-    }
+void ESP8266::setStaticIP(const ESP8266IPConfig *station, const ESP8266IPConfig *softap)
+{
+  m_staticIP = 0;
+  if (station) {
+    m_staticSTA = *station;
+    m_staticIP |= 1;
+  }
+  if (softap) {
+    m_staticAP = *softap;
+    m_staticIP |= 2;
+  }
+}
+
+bool ESP8266::applyStaticIP(void)
+{
+  if ((m_staticIP & 1) && !sATCIPADDR("STA", m_staticSTA)) {
+    return false;
+  }
+  if ((m_staticIP & 2) && !sATCIPADDR("AP", m_staticAP)) {
+    return false;
+  }
+  return true;
+}
+
+bool ESP8266::setDHCP(uint8_t mode, bool enable)
+{
+  if (mode > ESP8266_DHCP_BOTH) {
+    return false;
   }
-  return "Couldn't get IP adress";
+  return sATCWDHCP(mode, enable ? 1 : 0);
+}
+
+bool ESP8266::getStationIP(ESP8266IPConfig *config)
+{
+  return qATCIPADDR("STA", config);
+}
 
+bool ESP8266::getSoftAPIP(ESP8266IPConfig *config)
+{
+  return qATCIPADDR("AP", config);
 }
 
 bool ESP8266::enableMUX(void)
 {
+  if (cacheGet(ESP8266_CACHE_MUX) && m_cacheMux == 1) {
+    return true;
+  }
   return sATCIPMUX(1);
 }
 
 bool ESP8266::disableMUX(void)
 {
+  if (cacheGet(ESP8266_CACHE_MUX) && m_cacheMux == 0) {
+    return true;
+  }
   rx_empty();
 #ifdef ESP8266_USE_SOFTWARE_SERIAL
   String inData;
-  m_puart->println("AT+CIPMUX=0");
+  m_tx.println("AT+CIPMUX=0");
   delay(50);
-  while (m_puart->available() > 0) {
-    inData = m_puart->readStringUntil('\n');
+  while (rx_available() > 0) {
+    inData = rx_readStringUntil('\n');
     if (inData.indexOf("OK") != -1) {
       delay(100);
+      m_cacheMux = 0;
+      m_cacheValid |= ESP8266_CACHE_MUX;
       return true;
     }
   }
@@ -348,14 +638,18 @@ bool ESP8266::createTCP(String addr, uint32_t port)
 
 bool ESP8266::releaseTCP(void)
 {
+  if (!flush()) {
+    /* it would go to the next connection */
+    coalesceDiscard();
+  }
   rx_empty();
 #ifdef ESP8266_USE_SOFTWARE_SERIAL
 
   String inData;
-  m_puart->println("AT+CIPCLOSE");
+  m_tx.println("AT+CIPCLOSE");
   delay(50);
-  while (m_puart->available() > 0) {
-    inData = m_puart->readString();
+  while (rx_available() > 0) {
+    inData = rx_readStringUntil(-1);
     if (inData.indexOf("OK") != -1) {
       delay(100);
       return 1;
@@ -397,6 +691,21 @@ bool ESP8266::unregisterUDP(uint8_t mux_id)
   return sATCIPCLOSEMulitple(mux_id);
 }
 
+bool ESP8266::registerUDP(String addr, uint32_t port, uint32_t local_port, uint8_t mode)
+{
+  return sATCIPSTARTUDPSingle(addr, port, local_port, mode) && sATCIPDINFO(1);
+}
+
+bool ESP8266::registerUDP(uint8_t mux_id, String addr, uint32_t port, uint32_t local_port, uint8_t mode)
+{
+  return sATCIPSTARTUDPMultiple(mux_id, addr, port, local_port, mode) && sATCIPDINFO(1);
+}
+
+bool ESP8266::setRemoteInfo(bool enable)
+{
+  return sATCIPDINFO(enable ? 1 : 0);
+}
+
 bool ESP8266::setTCPServerTimeout(uint32_t timeout)
 {
   return sATCIPSTO(timeout);
@@ -404,6 +713,9 @@ bool ESP8266::setTCPServerTimeout(uint32_t timeout)
 
 bool ESP8266::startTCPServer(uint32_t port)
 {
+  if (cacheGet(ESP8266_CACHE_SERVER) && m_cachePort == port) {
+    return true;
+  }
   if (sATCIPSERVER(1, port)) {
     return true;
   }
@@ -429,50 +741,1459 @@ bool ESP8266::stopServer(void)
 
 bool ESP8266::send(const uint8_t *buffer, uint32_t len)
 {
-  return sATCIPSENDSingle(buffer, len);
+  if (m_coalesceBuffer == NULL) {
+    return sATCIPSENDSingle(buffer, len);
+  }
+  if (m_coalesceLen + len > m_coalesceSize) {
+    if (!flush()) {
+      return false;
+    }
+  }
+  if (len > m_coalesceSize) {
+    return sATCIPSENDSingle(buffer, len);
+  }
+  if (m_coalesceLen == 0) {
+    m_coalesceStart = millis();
+  }
+  memcpy(m_coalesceBuffer + m_coalesceLen, buffer, len);
+  m_coalesceLen += len;
+  m_coalesceStats.writes++;
+  if (m_coalesceLen >= m_coalesceThreshold || millis() - m_coalesceStart >= coalesceDelay()) {
+    return flush();
+  }
+  return true;
 }
 
-
-
-bool ESP8266::send(uint8_t mux_id, const uint8_t *buffer, uint32_t len)
+bool ESP8266::setPassiveRecv(bool enable)
 {
-  return sATCIPSENDMultiple(mux_id, buffer, len);
+  if (!(m_caps & ESP8266_CAP_CIPRECVMODE)) {
+    return false;
+  }
+  if (!sATCIPRECVMODE(enable ? 1 : 0)) {
+    if (!(m_caps & ESP8266_CAP_PROBED)) {
+      m_caps &= ~ESP8266_CAP_CIPRECVMODE;
+    }
+    return false;
+  }
+  m_passiveRecv = enable;
+  m_passiveSync = enable;
+  memset(m_passivePending, 0, sizeof(m_passivePending));
+  return true;
 }
 
-uint32_t ESP8266::recv(uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+#ifndef ESP8266_USE_SOFTWARE_SERIAL
+bool ESP8266::setFlowControl(uint32_t baud, uint8_t rts_pin, uint8_t cts_pin)
 {
-  return recvPkg(buffer, buffer_size, NULL, timeout, NULL);
+  uint8_t flow_control = 0;
+  if (cts_pin != ESP8266_NO_PIN) {
+    flow_control |= 1; /* ESP8266 drives its RTS */
+  }
+  if (rts_pin != ESP8266_NO_PIN) {
+    flow_control |= 2; /* ESP8266 honors its CTS */
+  }
+  if (!(m_caps & ESP8266_CAP_UART_CUR) || !sATUARTCUR(baud, flow_control)) {
+    return false;
+  }
+  m_rtsPin = rts_pin;
+  m_ctsPin = cts_pin;
+  m_rtsHeld = false;
+  if (m_rtsPin != ESP8266_NO_PIN) {
+    pinMode(m_rtsPin, OUTPUT);
+    digitalWrite(m_rtsPin, LOW);
+  }
+  if (m_ctsPin != ESP8266_NO_PIN) {
+    pinMode(m_ctsPin, INPUT);
+  }
+  delay(20);
+  m_puart->begin(baud);
+  m_baud = baud;
+  rx_empty();
+  return eAT();
 }
+#endif
 
+uint32_t ESP8266::beginBulk(uint32_t max_baud)
+{
+  String reference;
+  String echo;
+  ESP8266RateStats *rate;
 
+  if (m_bulkRate >= 0) {
+    return m_rateStats[m_bulkRate].baud;
+  }
+  if (!(m_caps & ESP8266_CAP_UART_CUR) || !eATGMR(reference)) {
+    return m_baud;
+  }
+  for (uint8_t i = 0; i < ESP8266_BULK_RATES; i++) {
+    rate = &m_rateStats[i];
+    if (rate->baud > max_baud || rate->baud <= m_baud) {
+      continue;
+    }
+    if (rate->failures >= 3 && rate->failures * 2 > rate->attempts) {
+      continue; /* learned to be unreliable on this board */
+    }
+    rate->attempts++;
+    if (bulkSwitch(rate->baud) && eATGMR(echo) && echo == reference) {
+      m_bulkRate = i;
+      m_bulkStart = millis();
+      m_bulkBytes = 0;
+      m_bulkOverruns = m_uartStats.rx_overruns;
+      return rate->baud;
+    }
+    rate->failures++;
+    if (!bulkRestore(rate->baud)) {
+      break;
+    }
+  }
+  return m_baud;
+}
 
-uint32_t ESP8266::recv(uint8_t mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+bool ESP8266::endBulk(bool ok)
 {
-  uint8_t id;
-  uint32_t ret;
-  ret = recvPkg(buffer, buffer_size, NULL, timeout, &id);
-  if (ret > 0 && id == mux_id) {
-    return ret;
+  ESP8266RateStats *rate;
+  if (m_bulkRate < 0) {
+    return true;
   }
-  return 0;
+  rate = &m_rateStats[m_bulkRate];
+  rate->bytes += m_bulkBytes;
+  rate->time += millis() - m_bulkStart;
+  if (!ok || m_uartStats.rx_overruns != m_bulkOverruns) {
+    rate->failures++;
+  }
+  m_bulkRate = -1;
+  return bulkRestore(rate->baud);
 }
 
-uint32_t ESP8266::recv(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+ESP8266RateStats ESP8266::getRateStats(uint8_t index)
 {
-  return recvPkg(buffer, buffer_size, NULL, timeout, coming_mux_id);
+  ESP8266RateStats none = {0, 0, 0, 0, 0};
+  return index < ESP8266_BULK_RATES ? m_rateStats[index] : none;
+}
+
+bool ESP8266::bulkSwitch(uint32_t baud)
+{
+  uint8_t flow_control = 0;
+#ifndef ESP8266_USE_SOFTWARE_SERIAL
+  if (m_ctsPin != ESP8266_NO_PIN) {
+    flow_control |= 1;
+  }
+  if (m_rtsPin != ESP8266_NO_PIN) {
+    flow_control |= 2;
+  }
+#endif
+  if (!sATUARTCUR(baud, flow_control)) {
+    return false;
+  }
+  /* the OK goes out at the old rate, the module switches after it */
+  delay(20);
+  m_puart->begin(baud);
+  rx_empty();
+  return true;
+}
+
+bool ESP8266::bulkRestore(uint32_t from)
+{
+  uint32_t safe = m_baud;
+  /* the module may be at either rate, depending on how far the switch got */
+  m_puart->begin(from);
+  bulkSwitch(safe);
+  m_puart->begin(safe);
+  rx_empty();
+  if (eAT()) {
+    return true;
+  }
+  return autoSetBaud(safe);
+}
+
+bool ESP8266::setTimeoutBounds(uint8_t cmd_class, uint16_t floor, uint16_t ceiling)
+{
+  ESP8266Timeout *t;
+  if (cmd_class >= ESP8266_CMD_CLASSES || floor == 0 || floor > ceiling) {
+    return false;
+  }
+  t = &m_timeouts[cmd_class];
+  t->floor = floor;
+  t->ceiling = ceiling;
+  if (t->rto < floor) {
+    t->rto = floor;
+  } else if (t->rto > ceiling) {
+    t->rto = ceiling;
+  }
+  return true;
+}
+
+ESP8266Timeout ESP8266::getTimeout(uint8_t cmd_class)
+{
+  if (cmd_class >= ESP8266_CMD_CLASSES) {
+    ESP8266Timeout none = {0, 0, 0, 0, 0, 0, 0};
+    return none;
+  }
+  return m_timeouts[cmd_class];
+}
+
+bool ESP8266::setPolicy(uint8_t op, uint8_t max_failures, uint16_t base_delay, uint16_t max_delay, uint32_t open_time)
+{
+  ESP8266Policy *p;
+  if (op >= ESP8266_OP_CLASSES || max_failures == 0) {
+    return false;
+  }
+  p = &m_policies[op];
+  p->max_failures = max_failures;
+  p->base_delay = base_delay;
+  p->max_delay = max_delay < base_delay ? base_delay : max_delay;
+  p->open_time = open_time;
+  return true;
+}
+
+ESP8266Policy ESP8266::getPolicy(uint8_t op)
+{
+  if (op >= ESP8266_OP_CLASSES) {
+    ESP8266Policy none = {0, 0, 0, 0, ESP8266_CIRCUIT_CLOSED, 0, 0, 0, 0, 0, 0};
+    return none;
+  }
+  return m_policies[op];
+}
+
+int8_t ESP8266::policyCheck(uint8_t op)
+{
+  ESP8266Policy *p;
+  if (op >= ESP8266_OP_CLASSES) {
+    return ESP8266_SUCCESS;
+  }
+  p = &m_policies[op];
+  if ((long)(millis() - p->next_attempt) < 0) {
+    return p->state == ESP8266_CIRCUIT_OPEN ? ESP8266_BREAKER_OPEN : ESP8266_BACKOFF;
+  }
+  if (p->state == ESP8266_CIRCUIT_OPEN) {
+    p->state = ESP8266_CIRCUIT_HALF_OPEN;
+  }
+  return ESP8266_SUCCESS;
+}
+
+int8_t ESP8266::policyReport(uint8_t op, bool success)
+{
+  ESP8266Policy *p;
+  uint32_t wait;
+  if (op >= ESP8266_OP_CLASSES) {
+    return success ? ESP8266_SUCCESS : ESP8266_FAILURE;
+  }
+  p = &m_policies[op];
+  p->attempts++;
+  if (p->consecutive > 0) {
+    p->retries++;
+  }
+  if (success) {
+    p->state = ESP8266_CIRCUIT_CLOSED;
+    p->consecutive = 0;
+    p->next_attempt = millis();
+    return ESP8266_SUCCESS;
+  }
+  p->failures++;
+  if (p->consecutive < 0xFF) {
+    p->consecutive++;
+  }
+  if (p->state == ESP8266_CIRCUIT_HALF_OPEN || p->consecutive >= p->max_failures) {
+    p->state = ESP8266_CIRCUIT_OPEN;
+    p->trips++;
+    wait = p->open_time;
+  } else {
+    wait = p->base_delay;
+    for (uint8_t i = 1; i < p->consecutive && wait < p->max_delay; i++) {
+      wait *= 2;
+    }
+    if (wait > p->max_delay) {
+      wait = p->max_delay;
+    }
+    wait -= random(wait / 2 + 1);
+  }
+  p->next_attempt = millis() + wait;
+  return ESP8266_FAILURE;
+}
+
+int8_t ESP8266::tryInit(const String &ssid, const String &pwd, uint32_t baudRateSet)
+{
+  uint8_t phase = m_initPhase;
+  uint8_t op = phase == 2 ? ESP8266_OP_JOIN : ESP8266_OP_INIT;
+  int8_t ret;
+  bool ok;
+
+  if (m_initPhase > 3) {
+    return ESP8266_SUCCESS;
+  }
+  ret = policyCheck(op);
+  if (ret != ESP8266_SUCCESS) {
+    return ret;
+  }
+  switch (m_initPhase) {
+    case 0:
+      ok = autoSetBaud(baudRateSet);
+      if (ok && !(m_caps & ESP8266_CAP_PROBED)) {
+        probeCapabilities();
+      }
+      break;
+    case 1:
+      ok = setOprToStationSoftAP() && applyStaticIP();
+      break;
+    case 2:
+      ok = joinAP(ssid, pwd);
+      break;
+    default:
+      ok = disableMUX();
+      break;
+  }
+  ret = policyReport(op, ok);
+  if (ok && m_initPhase != phase) {
+    /* the module was reset during the step(e.g. by the mode change), start over */
+    return ESP8266_PENDING;
+  }
+  if (ok) {
+    m_initPhase++;
+    return m_initPhase > 3 ? ESP8266_SUCCESS : ESP8266_PENDING;
+  }
+  return ret;
+}
+
+void ESP8266::resetInit(void)
+{
+  m_initPhase = 0;
+}
+
+int8_t ESP8266::tryJoinAP(String ssid, String pwd)
+{
+  int8_t ret = policyCheck(ESP8266_OP_JOIN);
+  if (ret != ESP8266_SUCCESS) {
+    return ret;
+  }
+  return policyReport(ESP8266_OP_JOIN, joinAP(ssid, pwd));
+}
+
+int8_t ESP8266::tryCreateTCP(String addr, uint32_t port)
+{
+  int8_t ret = policyCheck(ESP8266_OP_CONNECT);
+  if (ret != ESP8266_SUCCESS) {
+    return ret;
+  }
+  return policyReport(ESP8266_OP_CONNECT, createTCP(addr, port));
+}
+
+int8_t ESP8266::tryCreateTCP(uint8_t mux_id, String addr, uint32_t port)
+{
+  int8_t ret = policyCheck(ESP8266_OP_CONNECT);
+  if (ret != ESP8266_SUCCESS) {
+    return ret;
+  }
+  return policyReport(ESP8266_OP_CONNECT, createTCP(mux_id, addr, port));
+}
+
+void ESP8266::setRxBuffer(uint8_t *buffer, uint16_t size)
+{
+  m_rxRing = size > 0 ? buffer : NULL;
+  m_rxRingSize = m_rxRing ? size : 0;
+  m_rxHead = 0;
+  m_rxCount = 0;
+}
+
+ESP8266UartStats ESP8266::getUartStats(void)
+{
+  return m_uartStats;
+}
+
+void ESP8266::setTrace(uint8_t *buffer, uint16_t size)
+{
+  m_trace = NULL;
+  m_traceEntries = size / 4;
+  m_traceHead = 0;
+  m_traceCount = 0;
+  m_traceDropped = 0;
+  m_traceLast = micros();
+  if (buffer != NULL && m_traceEntries > 0) {
+    m_trace = buffer;
+  }
+}
+
+uint16_t ESP8266::dumpTrace(Print &out)
+{
+  uint8_t header[16] = {'E', 'S', 'P', 'T', 1, 0, 0, 0};
+  uint16_t count = m_traceCount;
+  uint16_t index = m_traceHead;
+
+  /* "ESPT", version 1, 3 reserved bytes, entry count and dropped entries, little endian */
+  for (uint8_t i = 0; i < 4; i++) {
+    header[8 + i] = (uint32_t)count >> (8 * i);
+    header[12 + i] = m_traceDropped >> (8 * i);
+  }
+  out.write(header, sizeof(header));
+  for (uint16_t i = 0; i < count; i++) {
+    uint32_t entry;
+    memcpy(&entry, m_trace + 4 * index, 4);
+    for (uint8_t k = 0; k < 4; k++) {
+      out.write((uint8_t)(entry >> (8 * k)));
+    }
+    index = index + 1 == m_traceEntries ? 0 : index + 1;
+  }
+  return count;
+}
+
+bool ESP8266::setCoalescing(uint8_t *buffer, uint16_t size, uint16_t threshold, uint32_t max_delay)
+{
+  if (buffer == NULL || size == 0) {
+    return false;
+  }
+  if (!flush()) {
+    return false;
+  }
+  m_coalesceBuffer = buffer;
+  m_coalesceSize = size;
+  m_coalesceThreshold = (threshold == 0 || threshold > size) ? size : threshold;
+  m_coalesceDelay = max_delay;
+  m_coalesceLen = 0;
+  return true;
+}
+
+bool ESP8266::disableCoalescing(void)
+{
+  bool ret = flush();
+  coalesceDiscard();
+  m_coalesceBuffer = NULL;
+  return ret;
+}
+
+bool ESP8266::flush(void)
+{
+  bool ret;
+  if (m_coalesceBuffer == NULL || m_coalesceLen == 0) {
+    return true;
+  }
+  ret = sATCIPSENDSingle(m_coalesceBuffer, m_coalesceLen);
+  m_coalesceStats.flushes++;
+  if (!ret) {
+    /* kept for the next flush, which poll tries after another max_delay */
+    m_coalesceStats.failures++;
+    m_coalesceStart = millis();
+    return false;
+  }
+  m_coalesceStats.bytes += m_coalesceLen;
+  m_coalesceLen = 0;
+  return true;
+}
+
+void ESP8266::coalesceDiscard(void)
+{
+  m_coalesceStats.dropped += m_coalesceLen;
+  m_coalesceLen = 0;
+}
+
+/* Steps of a link quality sample */
+#define MONITOR_IDLE    0
+#define MONITOR_RSSI    1   /* waiting for the answer to AT+CWJAP? */
+#define MONITOR_PING    2   /* waiting for the answer to AT+PING */
+#define MONITOR_JOIN    3   /* waiting for the answer to AT+CWJAP= of the supervisor */
+
+/* Give up on an answer after this many ms */
+#define MONITOR_RSSI_TIMEOUT    2000
+#define MONITOR_PING_TIMEOUT    5000
+
+void ESP8266::poll(void)
+{
+  uint8_t status;
+  if (m_rxRing) {
+    rx_pump();
+  }
+  if (m_coalesceLen > 0 && millis() - m_coalesceStart >= coalesceDelay()) {
+    flush();
+  }
+  /* after a failed cycle the batch waits a whole interval, even if 3/4 full */
+  if (m_uplinkLen > 0 && (millis() - m_uplinkStart >= m_uplinkInterval
+                          || (!m_uplinkFailed && m_uplinkLen >= m_uplinkSize - m_uplinkSize / 4))) {
+    flushUplink();
+  }
+  if (m_monitorInterval > 0 || m_monitorState != MONITOR_IDLE) {
+    monitorPoll();
+  }
+  /* a sleeping module does not answer: it is not a lost link */
+  if (!m_supervise || m_uplinkAsleep || m_monitorState != MONITOR_IDLE) {
+    return;
+  }
+  if (m_linkState != ESP8266_LINK_DOWN) {
+    if (m_linkState != ESP8266_LINK_UNKNOWN && millis() - m_linkProbed < m_probeInterval) {
+      return;
+    }
+    m_linkProbed = millis();
+    /* STATUS:2 got IP, 3 connected, 4 disconnected, 5 not joined */
+    if (qATCIPSTATUS(&status)) {
+      linkSet(status >= 2 && status <= 4 ? ESP8266_LINK_UP : ESP8266_LINK_DOWN);
+    } else if (!eAT()) {
+      linkSet(ESP8266_LINK_DOWN);
+    }
+    return;
+  }
+  if (policyCheck(ESP8266_OP_JOIN) != ESP8266_SUCCESS) {
+    return;
+  }
+  /* a join takes seconds: the answer is read by the next polls, like a link quality sample */
+  rx_empty();
+  joinSend(m_superviseSsid, m_supervisePwd, NULL);
+  m_monitorState = MONITOR_JOIN;
+  m_monitorStart = millis();
+  m_monitorLineLen = 0;
+}
+
+void ESP8266::startSupervisor(const String &ssid, const String &pwd, uint32_t probe_interval)
+{
+  m_superviseSsid = ssid;
+  m_supervisePwd = pwd;
+  m_probeInterval = probe_interval;
+  m_supervise = true;
+}
+
+void ESP8266::stopSupervisor(void)
+{
+  m_supervise = false;
+}
+
+void ESP8266::startMonitor(const String &host, uint32_t interval)
+{
+  m_monitorHost = host;
+  m_monitorInterval = interval > 0 ? interval : 1;
+  m_monitorStart = millis() - m_monitorInterval; /* the first sample at the next poll */
+}
+
+void ESP8266::stopMonitor(void)
+{
+  m_monitorInterval = 0;
+}
+
+void ESP8266::setQualityLimits(int8_t min_rssi, uint16_t max_rtt, uint8_t max_loss)
+{
+  m_minRssi = min_rssi;
+  m_maxRtt = max_rtt;
+  m_maxLoss = max_loss;
+}
+
+void ESP8266::setDegradedPacing(uint16_t gap, uint8_t batch)
+{
+  m_paceGap = gap;
+  m_paceBatch = batch > 0 ? batch : 1;
+}
+
+ESP8266LinkQuality ESP8266::getLinkQuality(void)
+{
+  return m_quality;
+}
+
+void ESP8266::monitorPoll(void)
+{
+  char c;
+
+  if (m_monitorState == MONITOR_IDLE) {
+    /* in active mode the data of the connections would come in between the answers */
+    if (m_monitorInterval == 0 || !m_passiveRecv || m_uplinkAsleep || millis() - m_monitorStart < m_monitorInterval || sending() || rx_available() > 0) {
+      return;
+    }
+    rx_empty();
+    m_tx.println("AT+CWJAP?");
+    m_monitorState = MONITOR_RSSI;
+    m_monitorStart = millis();
+    m_monitorLineLen = 0;
+    m_monitorValue = 0;
+    m_monitorNeg = false;
+    m_monitorRssi = 0;
+    m_monitorRtt = -1;
+    return;
+  }
+
+  while (rx_available() > 0) {
+    c = rx_read();
+    if (c == ',') {
+      m_monitorValue = 0;
+      m_monitorNeg = false;
+    } else if (c == '-') {
+      m_monitorNeg = true;
+    } else if (c >= '0' && c <= '9') {
+      m_monitorValue = m_monitorValue * 10 + (c - '0');
+    }
+    if (c != '\n') {
+      if (c != '\r' && m_monitorLineLen < sizeof(m_monitorLine)) {
+        m_monitorLine[m_monitorLineLen++] = c;
+      }
+      continue;
+    }
+
+    if (m_monitorState == MONITOR_JOIN) {
+      /* OK, or +CWJAP:<error> and FAIL */
+      if (m_monitorLineLen == 2 && strncmp(m_monitorLine, "OK", 2) == 0) {
+        monitorJoined(true);
+        return;
+      } else if ((m_monitorLineLen == 4 && strncmp(m_monitorLine, "FAIL", 4) == 0)
+                 || (m_monitorLineLen == 5 && strncmp(m_monitorLine, "ERROR", 5) == 0)) {
+        monitorJoined(false);
+        return;
+      }
+    } else if (m_monitorState == MONITOR_RSSI) {
+      /* +CWJAP:"<ssid>","<bssid>",<channel>,<rssi>, or No AP */
+      if (m_monitorLineLen >= 7 && strncmp(m_monitorLine, "+CWJAP:", 7) == 0) {
+        m_monitorRssi = m_monitorNeg ? -m_monitorValue : m_monitorValue;
+      } else if ((m_monitorLineLen == 2 && strncmp(m_monitorLine, "OK", 2) == 0)
+                 || (m_monitorLineLen == 5 && strncmp(m_monitorLine, "ERROR", 5) == 0)) {
+        if (m_monitorHost.length() == 0 || m_monitorDrain) {
+          monitorSample(m_monitorRssi, false, 0);
+          return;
+        }
+        m_tx.print("AT+PING=\"");
+        m_tx.print(m_monitorHost);
+        m_tx.println("\"");
+        m_monitorState = MONITOR_PING;
+        m_monitorStart = millis();
+      }
+    } else {
+      /* +<time> and OK, or +timeout and ERROR */
+      if (m_monitorLineLen >= 2 && m_monitorLine[0] == '+' && m_monitorLine[1] >= '0' && m_monitorLine[1] <= '9') {
+        m_monitorRtt = m_monitorValue;
+      } else if (m_monitorLineLen == 2 && strncmp(m_monitorLine, "OK", 2) == 0) {
+        monitorSample(m_monitorRssi, true, m_monitorRtt > 0 ? m_monitorRtt : 1);
+        return;
+      } else if (m_monitorLineLen == 5 && strncmp(m_monitorLine, "ERROR", 5) == 0) {
+        monitorSample(m_monitorRssi, true, 0);
+        return;
+      }
+    }
+    m_monitorLineLen = 0;
+    m_monitorValue = 0;
+    m_monitorNeg = false;
+  }
+
+  if (m_monitorState == MONITOR_RSSI && millis() - m_monitorStart > MONITOR_RSSI_TIMEOUT) {
+    m_monitorState = MONITOR_IDLE;
+  } else if (m_monitorState == MONITOR_PING && millis() - m_monitorStart > MONITOR_PING_TIMEOUT) {
+    monitorSample(m_monitorRssi, true, 0);
+  } else if (m_monitorState == MONITOR_JOIN && millis() - m_monitorStart > m_timeouts[ESP8266_CMD_JOIN].rto) {
+    timeoutExpired(ESP8266_CMD_JOIN);
+    m_monitorState = MONITOR_IDLE;
+    policyReport(ESP8266_OP_JOIN, false);
+  }
+}
+
+void ESP8266::monitorJoined(bool success)
+{
+  m_monitorState = MONITOR_IDLE;
+  timeoutSample(ESP8266_CMD_JOIN, millis() - m_monitorStart);
+  if (success) {
+    joinDone(m_superviseSsid);
+    m_linkProbed = millis();
+  }
+  policyReport(ESP8266_OP_JOIN, success);
+}
+
+void ESP8266::monitorDrain(void)
+{
+  /* read the answer up to OK, FAIL or ERROR, or until its step times out; no AT+PING after it */
+  m_monitorDrain = true;
+  while (m_monitorState != MONITOR_IDLE) {
+    monitorPoll();
+  }
+  m_monitorDrain = false;
+}
+
+void ESP8266::monitorSample(int8_t rssi, bool pinged, uint16_t rtt)
+{
+  ESP8266LinkQuality *q = &m_quality;
+  uint8_t lost = 0;
+
+  m_monitorState = MONITOR_IDLE;
+  q->samples++;
+  q->rssi = rssi;
+  if (rssi != 0) {
+    if (q->rssi_avg == 0) {
+      q->rssi_avg = rssi;
+      q->rssi_min = rssi;
+    } else {
+      q->rssi_avg = (7 * (int16_t)q->rssi_avg + rssi) / 8;
+      if (rssi < q->rssi_min) {
+        q->rssi_min = rssi;
+      }
+    }
+  }
+
+  if (pinged) {
+    q->rtt = rtt;
+    m_lossHistory = (m_lossHistory << 1) | (rtt == 0 ? 1 : 0);
+    if (m_lossCount < 16) {
+      m_lossCount++;
+    }
+    for (uint8_t i = 0; i < m_lossCount; i++) {
+      lost += (m_lossHistory >> i) & 1;
+    }
+    q->loss = lost * 100 / m_lossCount;
+    if (rtt > 0) {
+      if (q->rtt_avg == 0) {
+        q->rtt_avg = rtt;
+        q->rtt_var = rtt / 2;
+      } else {
+        q->rtt_var = (3 * (uint32_t)q->rtt_var + (rtt > q->rtt_avg ? rtt - q->rtt_avg : q->rtt_avg - rtt)) / 4;
+        q->rtt_avg = (7 * (uint32_t)q->rtt_avg + rtt) / 8;
+      }
+      if (rtt > q->rtt_max) {
+        q->rtt_max = rtt;
+      }
+    }
+  }
+
+  q->degraded = (q->rssi_avg != 0 && q->rssi_avg < m_minRssi)
+                || (q->rtt_avg > m_maxRtt) || (q->loss > m_maxLoss);
+}
+
+void ESP8266::pace(void)
+{
+  uint32_t since = millis() - m_lastSend;
+  if (m_quality.degraded && since < m_paceGap) {
+    m_quality.paced++;
+    delay(m_paceGap - since);
+  }
+  m_lastSend = millis();
+}
+
+uint32_t ESP8266::coalesceDelay(void)
+{
+  return m_quality.degraded ? m_coalesceDelay * m_paceBatch : m_coalesceDelay;
+}
+
+bool ESP8266::setUplink(uint8_t *buffer, uint16_t size, const String &host, uint32_t port, uint32_t interval,
+                        uint8_t sleep_mode, uint8_t wake_pin, uint8_t wake_gpio)
+{
+  if (buffer == NULL || size == 0 || size > 2048) {
+    return false;
+  }
+  /* only the wake GPIO ends a light sleep */
+  if (sleep_mode == ESP8266_SLEEP_LIGHT && (wake_pin == ESP8266_NO_PIN || wake_gpio == ESP8266_NO_PIN)) {
+    return false;
+  }
+  m_uplinkBuffer = buffer;
+  m_uplinkSize = size;
+  m_uplinkLen = 0;
+  m_uplinkRecords = 0;
+  m_uplinkHost = host;
+  m_uplinkPort = port;
+  m_uplinkInterval = interval;
+  m_uplinkSleep = sleep_mode;
+  m_wakePin = wake_pin;
+  if (m_wakePin != ESP8266_NO_PIN) {
+    pinMode(m_wakePin, OUTPUT);
+    digitalWrite(m_wakePin, HIGH);
+  }
+  if (m_uplinkSleep == ESP8266_SLEEP_MODEM) {
+    return sATSLEEP(2);
+  }
+  if (m_uplinkSleep == ESP8266_SLEEP_NONE) {
+    return sATSLEEP(0);
+  }
+  /* the pulse of wake_pin is low */
+  if (m_uplinkSleep == ESP8266_SLEEP_LIGHT && !sATWAKEUPGPIO(1, wake_gpio, 0)) {
+    return false;
+  }
+  uplinkSleep(interval);
+  return true;
+}
+
+bool ESP8266::queueUplink(const uint8_t *data, uint16_t len)
+{
+  if (m_uplinkBuffer == NULL || (uint32_t)m_uplinkLen + len > m_uplinkSize) {
+    m_uplinkStats.dropped++;
+    return false;
+  }
+  if (m_uplinkLen == 0) {
+    m_uplinkStart = millis();
+  }
+  memcpy(m_uplinkBuffer + m_uplinkLen, data, len);
+  m_uplinkLen += len;
+  m_uplinkRecords++;
+  return true;
+}
+
+bool ESP8266::flushUplink(void)
+{
+  unsigned long on;
+  bool ret = false;
+  if (m_uplinkBuffer == NULL || m_uplinkLen == 0) {
+    return true;
+  }
+  on = millis();
+  if (uplinkWake() && createTCP(m_uplinkHost, m_uplinkPort)) {
+    ret = sATCIPSENDSingle(m_uplinkBuffer, m_uplinkLen);
+    eATCIPCLOSESingle();
+  }
+  uplinkSleep(m_uplinkInterval);
+  m_uplinkStats.cycles++;
+  m_uplinkStats.last_radio_on = millis() - on;
+  m_uplinkStats.total_radio_on += m_uplinkStats.last_radio_on;
+  m_uplinkFailed = !ret;
+  if (!ret) {
+    m_uplinkStats.failures++;
+    m_uplinkStart = millis();
+    return false;
+  }
+  m_uplinkStats.records += m_uplinkRecords;
+  m_uplinkStats.bytes += m_uplinkLen;
+  m_uplinkLen = 0;
+  m_uplinkRecords = 0;
+  return true;
+}
+
+ESP8266UplinkStats ESP8266::getUplinkStats(void)
+{
+  return m_uplinkStats;
+}
+
+bool ESP8266::uplinkWake(void)
+{
+  m_uplinkAsleep = false;
+  if (m_uplinkSleep == ESP8266_SLEEP_LIGHT || m_uplinkSleep == ESP8266_SLEEP_DEEP) {
+    if (m_wakePin != ESP8266_NO_PIN) {
+      digitalWrite(m_wakePin, LOW);
+      delay(m_uplinkSleep == ESP8266_SLEEP_DEEP ? 10 : 1);
+      digitalWrite(m_wakePin, HIGH);
+    }
+  }
+  if (m_uplinkSleep == ESP8266_SLEEP_DEEP) {
+    /* a reset: wait for the banner, then for the station to rejoin from its saved config */
+    uint8_t status;
+    if (!recvReady(5000) && !kick()) {
+      return false;
+    }
+    if (m_linkState != ESP8266_LINK_UP) {
+      recvFindTimed("WIFI GOT IP", ESP8266_CMD_JOIN);
+    }
+    if (m_linkState != ESP8266_LINK_UP) {
+      /* woke up early and the notification went by */
+      return qATCIPSTATUS(&status) && status >= 2 && status <= 4;
+    }
+    return true;
+  }
+  if (m_uplinkSleep == ESP8266_SLEEP_LIGHT) {
+    return kick() && sATSLEEP(0);
+  }
+  return true;
+}
+
+void ESP8266::uplinkSleep(uint32_t duration)
+{
+  if (m_uplinkSleep == ESP8266_SLEEP_LIGHT) {
+    m_uplinkAsleep = sATSLEEP(1);
+  } else if (m_uplinkSleep == ESP8266_SLEEP_DEEP) {
+    /* a planned power down, not a disconnect */
+    sATGSLP(duration);
+    m_linkState = ESP8266_LINK_UNKNOWN;
+    m_uplinkAsleep = true;
+    cacheDrop(ESP8266_CACHE_ALL);
+  }
+}
+
+uint8_t ESP8266::getLinkState(void)
+{
+  return m_linkState;
+}
+
+ESP8266CacheStats ESP8266::getCacheStats(void)
+{
+  return m_cacheStats;
+}
+
+void ESP8266::invalidateCache(void)
+{
+  cacheDrop(ESP8266_CACHE_ALL);
+}
+
+ESP8266LinkStats ESP8266::getLinkStats(void)
+{
+  return m_linkStats;
+}
+
+ESP8266CoalesceStats ESP8266::getCoalesceStats(void)
+{
+  return m_coalesceStats;
+}
+
+
+
+bool ESP8266::send(uint8_t mux_id, const uint8_t *buffer, uint32_t len)
+{
+  return sATCIPSENDMultiple(mux_id, buffer, len);
+}
+
+bool ESP8266::send(uint32_t len, ESP8266SendProducer producer, void *context)
+{
+  if (!flush()) {
+    return false;
+  }
+  return sATCIPSENDStream(-1, len, producer, context);
+}
+
+bool ESP8266::send(uint8_t mux_id, uint32_t len, ESP8266SendProducer producer, void *context)
+{
+  return sATCIPSENDStream(mux_id, len, producer, context);
+}
+
+/* Producer of sendP: context is the data in flash */
+static uint16_t progmemProducer(uint8_t *buffer, uint16_t size, uint32_t offset, void *context)
+{
+  memcpy_P(buffer, (const uint8_t *)context + offset, size);
+  return size;
+}
+
+bool ESP8266::sendP(const uint8_t *buffer, uint32_t len)
+{
+  return send(len, progmemProducer, (void *)buffer);
+}
+
+bool ESP8266::sendP(uint8_t mux_id, const uint8_t *buffer, uint32_t len)
+{
+  return send(mux_id, len, progmemProducer, (void *)buffer);
+}
+
+/* Steps of the send started by sendBegin */
+#define ASYNC_IDLE      0
+#define ASYNC_PROMPT    1   /* waiting for ">" */
+#define ASYNC_PAYLOAD   2   /* writing the payload */
+#define ASYNC_SEND_OK   3   /* waiting for "SEND OK" */
+
+bool ESP8266::sendBegin(const uint8_t *buffer, uint32_t len, int8_t mux_id)
+{
+  if (m_asyncState != ASYNC_IDLE || buffer == NULL || len == 0 || len > ESP8266_MAX_CIPSEND) {
+    return false;
+  }
+#ifdef ESP8266_USE_SOFTWARE_SERIAL
+  m_puart->listen();
+#endif
+  rx_empty();
+  m_tx.print("AT+CIPSEND=");
+  if (mux_id >= 0) {
+    m_tx.print(mux_id);
+    m_tx.print(",");
+  }
+  m_tx.println(len);
+  m_asyncBuffer = buffer;
+  m_asyncLen = len;
+  m_asyncPos = 0;
+  m_asyncMatch = 0;
+  m_asyncError = 0;
+  m_asyncFail = 0;
+  m_asyncStart = millis();
+  m_asyncState = ASYNC_PROMPT;
+  return true;
+}
+
+int8_t ESP8266::sendPoll(void)
+{
+  const char *target = m_asyncState == ASYNC_PROMPT ? ">" : "SEND OK";
+  uint8_t cmd_class = m_asyncState == ASYNC_PROMPT ? ESP8266_CMD_PROMPT : ESP8266_CMD_SEND;
+  /* the time of SEND OK grows with the payload: only the rest is estimated */
+  uint32_t extra = m_asyncState == ASYNC_PROMPT ? 0 : m_asyncLen / ESP8266_SEND_BYTES_PER_MS;
+  uint32_t elapsed;
+  char c;
+
+  if (m_asyncState == ASYNC_IDLE) {
+    return ESP8266_FAILURE;
+  }
+
+  if (m_asyncState == ASYNC_PAYLOAD) {
+    uint32_t n = m_asyncLen - m_asyncPos;
+#ifndef ESP8266_USE_SOFTWARE_SERIAL
+    /* only what fits in the TX buffer, so the other modules are not held up */
+    int room = m_puart->availableForWrite();
+    if (room <= 0) {
+      return ESP8266_PENDING;
+    }
+    if ((uint32_t)room < n) {
+      n = room;
+    }
+#endif
+    while (n--) {
+      tx_write(m_asyncBuffer[m_asyncPos++]);
+    }
+    if (m_asyncPos == m_asyncLen) {
+      m_asyncState = ASYNC_SEND_OK;
+      m_asyncMatch = 0;
+      m_asyncError = 0;
+      m_asyncFail = 0;
+      m_asyncStart = millis();
+    }
+    return ESP8266_PENDING;
+  }
+
+  elapsed = millis() - m_asyncStart;
+  elapsed = elapsed > extra ? elapsed - extra : 0;
+  while (rx_available() > 0) {
+    c = rx_read();
+    m_asyncMatch = c == target[m_asyncMatch] ? m_asyncMatch + 1 : (c == target[0] ? 1 : 0);
+    m_asyncError = c == "ERROR"[m_asyncError] ? m_asyncError + 1 : (c == 'E' ? 1 : 0);
+    m_asyncFail = c == "FAIL"[m_asyncFail] ? m_asyncFail + 1 : (c == 'F' ? 1 : 0);
+    if (m_asyncError == 5 || m_asyncFail == 4) {
+      /* answered, only not with success */
+      timeoutSample(cmd_class, elapsed);
+      m_asyncState = ASYNC_IDLE;
+      return ESP8266_FAILURE;
+    }
+    if (target[m_asyncMatch] == '\0') {
+      timeoutSample(cmd_class, elapsed);
+      if (m_asyncState == ASYNC_SEND_OK) {
+        m_asyncState = ASYNC_IDLE;
+        return ESP8266_SUCCESS;
+      }
+      m_asyncState = ASYNC_PAYLOAD;
+      return ESP8266_PENDING;
+    }
+  }
+  if (millis() - m_asyncStart > m_timeouts[cmd_class].rto + extra) {
+    timeoutExpired(cmd_class);
+    m_asyncState = ASYNC_IDLE;
+    return ESP8266_FAILURE;
+  }
+  return ESP8266_PENDING;
+}
+
+bool ESP8266::sending(void)
+{
+  return m_asyncState != ASYNC_IDLE;
+}
+
+bool ESP8266::send(const __FlashStringHelper *str)
+{
+  return sendP((const uint8_t *)str, strlen_P((PGM_P)str));
+}
+
+/* Walk state of a scatter-gather send */
+struct SegmentCursor {
+  const ESP8266Segment *segments;
+  uint8_t count;
+  uint8_t index;      /* the segment being sent */
+  uint32_t start;     /* the offset of its first byte in the whole send */
+};
+
+/* Producer of the scatter-gather send: a piece of the current segment at a time */
+static uint16_t segmentProducer(uint8_t *buffer, uint16_t size, uint32_t offset, void *context)
+{
+  SegmentCursor *cursor = (SegmentCursor *)context;
+  const ESP8266Segment *segment;
+  uint16_t pos;
+
+  while (cursor->index < cursor->count && offset - cursor->start >= cursor->segments[cursor->index].len) {
+    cursor->start += cursor->segments[cursor->index].len;
+    cursor->index++;
+  }
+  if (cursor->index == cursor->count) {
+    return 0;
+  }
+  segment = &cursor->segments[cursor->index];
+  pos = offset - cursor->start;
+  if (size > segment->len - pos) {
+    size = segment->len - pos;
+  }
+  if (segment->progmem) {
+    memcpy_P(buffer, segment->data + pos, size);
+  } else {
+    memcpy(buffer, segment->data + pos, size);
+  }
+  return size;
+}
+
+bool ESP8266::send(const ESP8266Segment *segments, uint8_t count)
+{
+  SegmentCursor cursor = {segments, count, 0, 0};
+  uint32_t len = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    len += segments[i].len;
+  }
+  return send(len, segmentProducer, &cursor);
+}
+
+bool ESP8266::send(uint8_t mux_id, const ESP8266Segment *segments, uint8_t count)
+{
+  SegmentCursor cursor = {segments, count, 0, 0};
+  uint32_t len = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    len += segments[i].len;
+  }
+  return send(mux_id, len, segmentProducer, &cursor);
+}
+
+uint32_t ESP8266::recv(uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+{
+  flush();
+  if (m_passiveRecv) {
+    return recvPassive(buffer, buffer_size, timeout, -1, NULL);
+  }
+  return recvPkg(buffer, buffer_size, NULL, timeout, NULL);
+}
+
+
+
+uint32_t ESP8266::recv(uint8_t mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+{
+  uint8_t id;
+  uint32_t ret;
+  if (m_passiveRecv) {
+    return recvPassive(buffer, buffer_size, timeout, mux_id, &id);
+  }
+  ret = recvPkg(buffer, buffer_size, NULL, timeout, &id);
+  if (ret > 0 && id == mux_id) {
+    return ret;
+  }
+  return 0;
+}
+
+uint32_t ESP8266::recv(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout)
+{
+  if (m_passiveRecv) {
+    return recvPassive(buffer, buffer_size, timeout, -1, coming_mux_id);
+  }
+  return recvPkg(buffer, buffer_size, NULL, timeout, coming_mux_id);
+}
+
+uint32_t ESP8266::recvPieces(uint8_t *buffer, uint16_t size, ESP8266RecvSink sink, void *context, uint32_t timeout)
+{
+  uint32_t total = 0;
+  uint32_t len;
+
+  /* the last piece is handed over too, not pulled and dropped */
+  for (uint8_t i = 0; i < 32; i++) {
+    len = recv(buffer, size, i == 0 ? timeout : 1);
+    if (len == 0) {
+      break;
+    }
+    sink(buffer, len, context);
+    total += len;
+  }
+  return total;
+}
+
+bool ESP8266::sendTo(const uint8_t *buffer, uint32_t len, String addr, uint32_t port)
+{
+  return sATCIPSENDSingleTo(buffer, len, addr, port);
+}
+
+bool ESP8266::sendTo(uint8_t mux_id, const uint8_t *buffer, uint32_t len, String addr, uint32_t port)
+{
+  return sATCIPSENDMultipleTo(mux_id, buffer, len, addr, port);
+}
+
+uint32_t ESP8266::recvFrom(uint8_t *buffer, uint32_t buffer_size, String &addr, uint32_t *port, uint32_t timeout)
+{
+  return recvPkg(buffer, buffer_size, NULL, timeout, NULL, &addr, port);
+}
+
+uint32_t ESP8266::recvFrom(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t buffer_size, String &addr, uint32_t *port, uint32_t timeout)
+{
+  return recvPkg(buffer, buffer_size, NULL, timeout, coming_mux_id, &addr, port);
+}
+
+/* Results of one connection of a download */
+#define DOWNLOAD_DONE       0   /* the body is complete */
+#define DOWNLOAD_DROPPED    1   /* go on from state->offset on a new connection */
+#define DOWNLOAD_FAILED     2   /* refused by the server or stopped by the sink */
+
+/* Where the AT output between +IPD frames is parsed */
+#define DOWNLOAD_AT_LINE    0   /* in a line, e.g. "SEND OK" or "CLOSED" */
+#define DOWNLOAD_AT_LEN     1   /* in the length after "+IPD," */
+#define DOWNLOAD_AT_INFO    2   /* in the address after the length(AT+CIPDINFO=1) */
+
+/* CRC-32 of IEEE 802.3(as zlib), 4 bits at a time */
+static const uint32_t crc32Table[16] PROGMEM = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t *data, uint16_t len)
+{
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    crc = pgm_read_dword(&crc32Table[crc & 0x0F]) ^ (crc >> 4);
+    crc = pgm_read_dword(&crc32Table[crc & 0x0F]) ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+/* The value of an HTTP header line if it has the name(lower case, with the colon), else NULL */
+static const char *headerValue(const char *line, const char *name)
+{
+  while (*name) {
+    char c = *line++;
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+    if (c != *name++) {
+      return NULL;
+    }
+  }
+  while (*line == ' ') {
+    line++;
+  }
+  return line;
+}
+
+bool ESP8266::download(String host, uint32_t port, const char *path, uint8_t *buffer, uint16_t size,
+                       ESP8266DownloadSink sink, void *context, ESP8266Download *state,
+                       uint8_t retries, uint32_t timeout)
+{
+  bool passive = m_passiveRecv;
+  uint8_t result = DOWNLOAD_DROPPED;
+  uint8_t tries = 0;
+  uint32_t offset;
+
+  if (buffer == NULL || size < 2 || sink == NULL || state == NULL) {
+    return false;
+  }
+  /* the body has to come in +IPD frames */
+  if (passive && !setPassiveRecv(false)) {
+    return false;
+  }
+  state->connections = 0;
+  while (result == DOWNLOAD_DROPPED && tries <= retries) {
+    if (state->total > 0 && state->offset >= state->total) {
+      result = DOWNLOAD_DONE;
+      break;
+    }
+    offset = state->offset;
+    result = downloadRange(host, port, path, buffer, size / 2, sink, context, state, timeout);
+    /* only connections which bring nothing count against retries */
+    tries = state->offset > offset ? 0 : tries + 1;
+  }
+  if (passive) {
+    setPassiveRecv(true);
+  }
+  return result == DOWNLOAD_DONE;
+}
+
+uint8_t ESP8266::downloadRange(const String &host, uint32_t port, const char *path, uint8_t *buffer,
+                               uint16_t half, ESP8266DownloadSink sink, void *context,
+                               ESP8266Download *state, uint32_t timeout)
+{
+  String request;
+  char at[10];                /* the start of the current line of AT output */
+  uint8_t atLen = 0;
+  uint8_t step = DOWNLOAD_AT_LINE;
+  char head[48];              /* the start of the current HTTP header line */
+  uint8_t headLen = 0;
+  bool body = false;
+  bool closed = false;
+  bool ok = true;             /* the sink takes the data */
+  uint32_t frameLen = 0;
+  uint32_t frameLeft = 0;     /* bytes of the current +IPD frame not read yet */
+  int32_t length = -1;        /* Content-Length */
+  int32_t rangeStart = -1;    /* the first byte of Content-Range */
+  uint32_t total = 0;         /* the length of the whole file by Content-Range */
+  uint32_t skip = 0;          /* bytes before offset, sent when the server ignores the range */
+  uint32_t end = 0;           /* the offset after the body, 0 if unknown */
+  uint8_t *fill = buffer;     /* the half being filled */
+  uint16_t fillLen = 0;
+  uint8_t *ready = NULL;      /* the full half waiting for the sink */
+  uint32_t overruns;
+  unsigned long start;
+  int c;
+
+  state->connections++;
+  if (!sATCIPSTARTSingle("TCP", host, port)) {
+    return DOWNLOAD_DROPPED;
+  }
+  request = "GET ";
+  request += path;
+  /* HTTP/1.0: no chunked transfer coding */
+  request += " HTTP/1.0\r\nHost: ";
+  request += host;
+  if (state->offset > 0) {
+    request += "\r\nRange: bytes=";
+    request += state->offset;
+    request += "-";
+  }
+  request += "\r\nConnection: close\r\n\r\n";
+
+  pace();
+  rx_empty();
+  m_tx.print("AT+CIPSEND=");
+  m_tx.println(request.length());
+  if (!recvFindTimed(">", ESP8266_CMD_PROMPT)) {
+    eATCIPCLOSESingle();
+    return DOWNLOAD_DROPPED;
+  }
+  rx_empty();
+  for (uint16_t i = 0; i < request.length(); i++) {
+    tx_write(request[i]);
+  }
+
+  /* "SEND OK" is read with the response, so a frame right behind it is not lost */
+  overruns = m_uartStats.rx_overruns;
+  start = millis();
+  while (ok && !closed) {
+    c = rx_available();
+    if (m_uartStats.rx_overruns != overruns) {
+      /* bytes were lost behind those read already: keep these, ask again for the rest */
+      state->overruns++;
+      break;
+    }
+    if (c <= 0) {
+      if (ready != NULL && frameLeft == 0) {
+        /* between frames: the sink has the time until the next one */
+        ok = downloadSink(ready, half, sink, context, state);
+        ready = NULL;
+      } else if (millis() - start >= timeout) {
+        break;
+      }
+      continue;
+    }
+    /* the body is not scanned for notifications */
+    c = frameLeft > 0 ? rx_readPayload() : rx_read();
+    start = millis();
+
+    if (frameLeft == 0) {
+      if (step == DOWNLOAD_AT_LEN && c >= '0' && c <= '9') {
+        frameLen = frameLen * 10 + (c - '0');
+      } else if (step != DOWNLOAD_AT_LINE && c == ':') {
+        frameLeft = frameLen;
+        state->frames++;
+        step = DOWNLOAD_AT_LINE;
+        m_linkLineLen = 0;
+      } else if (step == DOWNLOAD_AT_LEN && c == ',') {
+        step = DOWNLOAD_AT_INFO;
+      } else if (step == DOWNLOAD_AT_LINE && c == '\n') {
+        if ((atLen >= 6 && strncmp(at, "CLOSED", 6) == 0)) {
+          closed = true;
+        } else if ((atLen >= 9 && strncmp(at, "SEND FAIL", 9) == 0)
+                   || (atLen >= 5 && strncmp(at, "ERROR", 5) == 0)) {
+          break;
+        }
+        atLen = 0;
+      } else if (step == DOWNLOAD_AT_LINE && atLen < sizeof(at)) {
+        at[atLen++] = c;
+        if (atLen == 5 && strncmp(at, "+IPD,", 5) == 0) {
+          step = DOWNLOAD_AT_LEN;
+          frameLen = 0;
+          atLen = 0;
+        }
+      }
+      continue;
+    }
+    frameLeft--;
+
+    if (!body) {
+      if (c == '\r') {
+        continue;
+      }
+      if (c != '\n') {
+        if (headLen < sizeof(head) - 1) {
+          head[headLen++] = c;
+        }
+        continue;
+      }
+      head[headLen] = '\0';
+      if (headLen > 0) {
+        const char *value;
+        if (strncmp(head, "HTTP/", 5) == 0 && (value = strchr(head, ' ')) != NULL) {
+          state->status = atoi(value + 1);
+        } else if ((value = headerValue(head, "content-length:")) != NULL) {
+          length = strtoul(value, NULL, 10);
+        } else if ((value = headerValue(head, "content-range:")) != NULL) {
+          /* bytes <first>-<last>/<total> */
+          if (strncmp(value, "bytes ", 6) == 0) {
+            rangeStart = strtoul(value + 6, NULL, 10);
+          }
+          value = strchr(value, '/');
+          if (value != NULL && value[1] != '*') {
+            total = strtoul(value + 1, NULL, 10);
+          }
+        }
+        headLen = 0;
+        continue;
+      }
+
+      /* the empty line: the body follows */
+      if (state->status == 206 && rangeStart == (int32_t)state->offset) {
+        end = length >= 0 ? state->offset + length : total;
+      } else if (state->status == 200) {
+        skip = state->offset;
+        end = length >= 0 ? length : 0;
+        total = end;
+      } else {
+        ok = false;
+        break;
+      }
+      if (total > 0) {
+        if (state->total > 0 && state->total != total) {
+          /* the file changed since the download started */
+          ok = false;
+          break;
+        }
+        state->total = total;
+      }
+      body = true;
+    } else if (skip > 0) {
+      skip--;
+    } else {
+      fill[fillLen++] = c;
+      if (fillLen == half) {
+        if (ready != NULL) {
+          /* both halves are full: the rest of the frame waits in the UART */
+          state->stalls++;
+          ok = downloadSink(ready, half, sink, context, state);
+        }
+        ready = fill;
+        fill = fill == buffer ? buffer + half : buffer;
+        fillLen = 0;
+      }
+      if (end > 0 && state->offset + (ready != NULL ? half : 0) + fillLen >= end) {
+        break;
+      }
+    }
+  }
+
+  /* whatever arrived is kept, also from a dropped connection */
+  if (ok && ready != NULL) {
+    ok = downloadSink(ready, half, sink, context, state);
+  }
+  if (ok && fillLen > 0) {
+    ok = downloadSink(fill, fillLen, sink, context, state);
+  }
+  if (!closed) {
+    eATCIPCLOSESingle();
+  }
+  if (!ok) {
+    return DOWNLOAD_FAILED;
+  }
+  if (body && (end > 0 ? state->offset >= end : closed)) {
+    return DOWNLOAD_DONE;
+  }
+  return DOWNLOAD_DROPPED;
+}
+
+bool ESP8266::downloadSink(const uint8_t *data, uint16_t len, ESP8266DownloadSink sink, void *context,
+                           ESP8266Download *state)
+{
+  unsigned long start = millis();
+  bool ret = sink(data, len, state->offset, context);
+  state->sink_time += millis() - start;
+  state->swaps++;
+  if (ret) {
+    state->crc = crc32Update(state->crc, data, len);
+    state->offset += len;
+  }
+  return ret;
 }
 
 /*----------------------------------------------------------------------------*/
 /* +IPD,<id>,<len>:<data> */
 /* +IPD,<len>:<data> */
+/* +IPD,<id>,<len>,<ip>,<port>:<data> (AT+CIPDINFO=1) */
+/* +IPD,<len>,<ip>,<port>:<data> (AT+CIPDINFO=1) */
 
-uint32_t ESP8266::recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_len, uint32_t timeout, uint8_t *coming_mux_id)
+uint32_t ESP8266::recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_len, uint32_t timeout, uint8_t *coming_mux_id,
+                          String *remote_ip, uint32_t *remote_port)
 {
   String data;
   char a;
   int32_t index_PIPDcomma = -1;
   int32_t index_colon = -1; /* : */
-  int32_t index_comma = -1; /* , */
+  int32_t index_comma[3] = {-1, -1, -1}; /* , */
+  uint8_t commas;
   int32_t len = -1;
   int8_t id = -1;
   bool has_data = false;
@@ -486,8 +2207,8 @@ uint32_t ESP8266::recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_
 
   start = millis();
   while (millis() - start < timeout) {
-    if (m_puart->available() > 0) {
-      a = m_puart->read();
+    if (rx_available() > 0) {
+      a = rx_read();
       data += a;
     }
 
@@ -495,22 +2216,37 @@ uint32_t ESP8266::recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_
     if (index_PIPDcomma != -1) {
       index_colon = data.indexOf(':', index_PIPDcomma + 5);
       if (index_colon != -1) {
-        index_comma = data.indexOf(',', index_PIPDcomma + 5);
-        /* +IPD,id,len:data */
-        if (index_comma != -1 && index_comma < index_colon) {
-          id = data.substring(index_PIPDcomma + 5, index_comma).toInt();
+        commas = 0;
+        while (commas < 3) {
+          int32_t from = commas ? index_comma[commas - 1] + 1 : index_PIPDcomma + 5;
+          int32_t index = data.indexOf(',', from);
+          if (index == -1 || index > index_colon) {
+            break;
+          }
+          index_comma[commas++] = index;
+        }
+        /* +IPD,id,len or +IPD,id,len,ip,port */
+        int32_t index_len = index_PIPDcomma + 5;
+        if (commas == 1 || commas == 3) {
+          id = data.substring(index_PIPDcomma + 5, index_comma[0]).toInt();
           if (id < 0 || id > 4) {
             return 0;
           }
-          len = data.substring(index_comma + 1, index_colon).toInt();
-          if (len <= 0) {
-            return 0;
+          index_len = index_comma[0] + 1;
+        }
+        if (commas >= 2) {
+          len = data.substring(index_len, index_comma[commas - 2]).toInt();
+          if (remote_ip) {
+            *remote_ip = data.substring(index_comma[commas - 2] + 1, index_comma[commas - 1]);
           }
-        } else { /* +IPD,len:data */
-          len = data.substring(index_PIPDcomma + 5, index_colon).toInt();
-          if (len <= 0) {
-            return 0;
+          if (remote_port) {
+            *remote_port = data.substring(index_comma[commas - 1] + 1, index_colon).toInt();
           }
+        } else {
+          len = data.substring(index_len, index_colon).toInt();
+        }
+        if (len <= 0) {
+          return 0;
         }
         has_data = true;
         break;
@@ -520,19 +2256,35 @@ uint32_t ESP8266::recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_
 
   if (has_data) {
     i = 0;
-    ret = len > buffer_size ? buffer_size : len;
+    ret = (uint32_t)len > buffer_size ? buffer_size : len;
+    /* the payload is not scanned for notifications, the line after it starts afresh */
+    m_linkLineLen = 0;
     start = millis();
     while (millis() - start < 3000) {
-      while (m_puart->available() > 0 && i < ret) {
-        a = m_puart->read();
+      while (rx_available() > 0 && i < ret) {
+        a = rx_readPayload();
         buffer[i++] = a;
       }
       if (i == ret) {
-        rx_empty();
+        if (remote_ip) {
+          /* Drop only the rest of this datagram, keep the ones queued behind it */
+          while (i < (uint32_t)len && millis() - start < 3000) {
+            if (rx_available() > 0) {
+              rx_readPayload();
+              i++;
+            }
+          }
+        } else {
+          while (i < (uint32_t)len && rx_available() > 0) {
+            rx_readPayload();
+            i++;
+          }
+          rx_empty();
+        }
         if (data_len) {
           *data_len = len;
         }
-        if (index_comma != -1 && coming_mux_id) {
+        if (id != -1 && coming_mux_id) {
           *coming_mux_id = id;
         }
         return ret;
@@ -542,10 +2294,406 @@ uint32_t ESP8266::recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_
   return 0;
 }
 
+/* +IPD,<id>,<len> */
+/* +IPD,<len> */
+
+uint32_t ESP8266::recvPassive(uint8_t *buffer, uint32_t buffer_size, uint32_t timeout, int8_t mux_id, uint8_t *coming_mux_id)
+{
+  bool single = (mux_id == -1 && coming_mux_id == NULL);
+  int8_t id = -1;
+  uint32_t want;
+  uint32_t ret;
+  unsigned long start;
+
+  if (buffer == NULL || buffer_size == 0) {
+    return 0;
+  }
+
+  start = millis();
+  while (true) {
+    for (int8_t i = 0; i < 5; i++) {
+      if (m_passivePending[i] > 0 && (mux_id == -1 || mux_id == i)) {
+        id = i;
+        break;
+      }
+    }
+    if (id != -1) {
+      break;
+    }
+    if (millis() - start >= timeout) {
+      return 0;
+    }
+    if (m_passiveSync) {
+      qATCIPRECVLEN();
+      m_passiveSync = false;
+      continue;
+    }
+    recvPassiveNotify(timeout - (millis() - start));
+  }
+
+  want = m_passivePending[id] > buffer_size ? buffer_size : m_passivePending[id];
+  ret = sATCIPRECVDATA(single ? -1 : id, buffer, want);
+  if (ret < want) {
+    m_passivePending[id] = 0;
+  } else {
+    m_passivePending[id] -= ret;
+  }
+  if (coming_mux_id) {
+    *coming_mux_id = id;
+  }
+  return ret;
+}
+
+bool ESP8266::recvPassiveNotify(uint32_t timeout)
+{
+  String data;
+  int32_t index_PIPDcomma;
+  int32_t index_end;
+  int32_t index_comma;
+  int32_t len;
+  int8_t id = 0;
+  unsigned long start = millis();
+
+  while (millis() - start < timeout) {
+    if (rx_available() > 0) {
+      data += (char)rx_read();
+    }
+    index_PIPDcomma = data.indexOf("+IPD,");
+    if (index_PIPDcomma == -1) {
+      continue;
+    }
+    index_end = data.indexOf("\r\n", index_PIPDcomma + 5);
+    if (index_end == -1) {
+      continue;
+    }
+    index_comma = data.indexOf(',', index_PIPDcomma + 5);
+    if (index_comma != -1 && index_comma < index_end) {
+      id = data.substring(index_PIPDcomma + 5, index_comma).toInt();
+      len = data.substring(index_comma + 1, index_end).toInt();
+    } else {
+      len = data.substring(index_PIPDcomma + 5, index_end).toInt();
+    }
+    if (id < 0 || id > 4 || len <= 0) {
+      return false;
+    }
+    m_passivePending[id] += len;
+    /* counted here, no need to ask */
+    m_passiveSync = false;
+    return true;
+  }
+  return false;
+}
+
 void ESP8266::rx_empty(void)
 {
+  /* another command: the module takes it only after the answer of a sample or join from poll */
+  if (m_monitorState != MONITOR_IDLE) {
+    monitorDrain();
+  }
+  while (rx_available() > 0) {
+    rx_read();
+    if (m_passiveRecv) {
+      m_passiveSync = true;
+    }
+  }
+}
+
+#ifdef SERIAL_RX_BUFFER_SIZE
+#define ESP8266_UART_RX_SIZE  SERIAL_RX_BUFFER_SIZE
+#else
+#define ESP8266_UART_RX_SIZE  64
+#endif
+
+int ESP8266::rx_available(void)
+{
+  int n = m_puart->available();
+#ifdef ESP8266_USE_SOFTWARE_SERIAL
+  if (m_puart->overflow()) {
+    m_uartStats.rx_overruns++;
+  }
+#else
+  /* the ring keeps one slot free, so size - 1 bytes means it is full */
+  if (n >= ESP8266_UART_RX_SIZE - 1) {
+    if (!m_rxFull) {
+      m_uartStats.rx_overruns++;
+    }
+    m_rxFull = true;
+  } else {
+    m_rxFull = false;
+  }
+#endif
+  if (m_rxRing) {
+    rx_pump();
+  }
+#ifndef ESP8266_USE_SOFTWARE_SERIAL
+  if (m_rtsPin != ESP8266_NO_PIN) {
+    /* with the library buffer, keep room for what the ESP8266 sends before it sees RTS */
+    bool hold = m_rxRing ? m_rxRingSize - m_rxCount < ESP8266_UART_RX_SIZE - ESP8266_RTS_HIGH_WATER
+                : n >= ESP8266_RTS_HIGH_WATER;
+    if (hold != m_rtsHeld) {
+      digitalWrite(m_rtsPin, hold ? HIGH : LOW);
+      if (hold) {
+        m_uartStats.rts_pauses++;
+      }
+      m_rtsHeld = hold;
+    }
+  }
+#endif
+  return m_rxRing ? m_rxCount : n;
+}
+
+int ESP8266::rx_read(void)
+{
+  int c = rx_readPayload();
+  if (c >= 0) {
+    linkScan(c);
+  }
+  return c;
+}
+
+int ESP8266::rx_readPayload(void)
+{
+  int c;
+  if (m_rxRing) {
+    if (m_rxCount == 0) {
+      rx_pump();
+      if (m_rxCount == 0) {
+        return -1;
+      }
+    }
+    c = m_rxRing[m_rxHead];
+    m_rxHead = m_rxHead + 1 == m_rxRingSize ? 0 : m_rxHead + 1;
+    m_rxCount--;
+  } else {
+    c = m_puart->read();
+    if (c >= 0 && m_trace) {
+      traceByte(ESP8266_TRACE_RX, c);
+    }
+  }
+  if (c >= 0) {
+    m_bulkBytes++;
+  }
+  return c;
+}
+
+String ESP8266::rx_readStringUntil(int terminator)
+{
+  String data;
+  unsigned long start = millis();
+  int c;
+
+  /* like Stream::readStringUntil: stop at the terminator or after a second without data */
+  while (millis() - start < 1000) {
+    if (rx_available() > 0) {
+      c = rx_read();
+      if (c == terminator) {
+        break;
+      }
+      data += (char)c;
+      start = millis();
+    }
+  }
+  return data;
+}
+
+void ESP8266::rx_pump(void)
+{
+  uint16_t tail;
   while (m_puart->available() > 0) {
-    m_puart->read();
+    uint8_t c = m_puart->read();
+    if (m_trace) {
+      traceByte(ESP8266_TRACE_RX, c);
+    }
+    if (m_rxCount == m_rxRingSize) {
+      m_uartStats.rx_lost++;
+      continue;
+    }
+    tail = m_rxHead + m_rxCount;
+    if (tail >= m_rxRingSize) {
+      tail -= m_rxRingSize;
+    }
+    m_rxRing[tail] = c;
+    m_rxCount++;
+    if (m_rxCount > m_uartStats.rx_high_water) {
+      m_uartStats.rx_high_water = m_rxCount;
+    }
+  }
+}
+
+void ESP8266::linkScan(char c)
+{
+  if (c == '\n') {
+    if (m_linkLineLen >= 11 && strncmp(m_linkLine, "WIFI GOT IP", 11) == 0) {
+      linkSet(ESP8266_LINK_UP);
+    } else if (m_linkLineLen >= 15 && strncmp(m_linkLine, "WIFI DISCONNECT", 15) == 0) {
+      linkSet(ESP8266_LINK_DOWN);
+    } else if (m_linkLineLen >= 14 && strncmp(m_linkLine, "WIFI CONNECTED", 14) == 0) {
+      linkSet(ESP8266_LINK_CONNECTED);
+    } else if (m_linkLineLen >= 5 && strncmp(m_linkLine, "ready", 5) == 0) {
+      /* the module was reset: the cached state and the setup of tryInit are gone */
+      cacheDrop(ESP8266_CACHE_ALL);
+      m_initPhase = 0;
+    } else if (m_passiveRecv && m_linkLineLen >= 5 && strncmp(m_linkLine, "+IPD,", 5) == 0) {
+      /* data came in the middle of another answer: recvPassive asks AT+CIPRECVLEN? for how much */
+      m_passiveSync = true;
+    }
+    m_linkLineLen = 0;
+  } else if (m_linkLineLen < sizeof(m_linkLine)) {
+    m_linkLine[m_linkLineLen++] = c;
+  }
+}
+
+bool ESP8266::cacheGet(uint8_t part)
+{
+  /*
+   * a hit sends no command, so read what came in as the command would: "ready" or
+   * "WIFI DISCONNECT" waiting there drops the part before it is answered
+   */
+  if ((m_cacheValid & part) && m_asyncState == ASYNC_IDLE && rx_available() > 0) {
+    rx_empty();
+  }
+  if (m_cacheValid & part) {
+    m_cacheStats.hits++;
+    return true;
+  }
+  m_cacheStats.misses++;
+  return false;
+}
+
+void ESP8266::cacheDrop(uint8_t parts)
+{
+  if (m_cacheValid & parts) {
+    m_cacheStats.invalidations++;
+    m_cacheValid &= ~parts;
+  }
+}
+
+/* Copy the quoted value after name, e.g. +CIFSR:STAIP,"192.168.1.5" */
+static bool quotedField(const String &data, const char *name, char *out, uint8_t size)
+{
+  int index1 = data.indexOf(name);
+  int index2;
+  if (index1 == -1) {
+    return false;
+  }
+  index1 += strlen(name);
+  index2 = data.indexOf('"', index1);
+  if (index2 == -1 || index2 - index1 >= size) {
+    return false;
+  }
+  data.substring(index1, index2).toCharArray(out, size);
+  return true;
+}
+
+bool ESP8266::cacheAddr(void)
+{
+  String list;
+  if (!eATCIFSR(list)) {
+    return false;
+  }
+  /* the station address, the softAP one in softAP only mode */
+  if (!quotedField(list, "STAIP,\"", m_cacheIP, sizeof(m_cacheIP))
+      && !quotedField(list, "APIP,\"", m_cacheIP, sizeof(m_cacheIP))) {
+    return false;
+  }
+  if (!quotedField(list, "STAMAC,\"", m_cacheMAC, sizeof(m_cacheMAC))
+      && !quotedField(list, "APMAC,\"", m_cacheMAC, sizeof(m_cacheMAC))) {
+    m_cacheMAC[0] = '\0';
+  }
+  m_cacheValid |= ESP8266_CACHE_ADDR;
+  return true;
+}
+
+void ESP8266::linkSet(uint8_t state)
+{
+  unsigned long now = millis();
+  uint32_t latency;
+  if (state == m_linkState) {
+    return;
+  }
+  if (state == ESP8266_LINK_DOWN) {
+    cacheDrop(ESP8266_CACHE_AP | ESP8266_CACHE_ADDR);
+  } else if (state == ESP8266_LINK_CONNECTED) {
+    cacheDrop(ESP8266_CACHE_AP);
+  } else if (state == ESP8266_LINK_UP) {
+    cacheDrop(ESP8266_CACHE_ADDR);
+  }
+  if (state == ESP8266_LINK_DOWN && m_linkState != ESP8266_LINK_UNKNOWN) {
+    m_linkStats.disconnects++;
+    m_linkDownSince = now;
+  } else if (state == ESP8266_LINK_DOWN) {
+    m_linkDownSince = now;
+  } else if (state == ESP8266_LINK_UP && m_linkState != ESP8266_LINK_UNKNOWN && m_linkStats.disconnects > 0) {
+    latency = now - m_linkDownSince;
+    m_linkStats.reconnects++;
+    m_linkStats.down_time += latency;
+    m_linkStats.last_latency = latency;
+    if (latency > m_linkStats.max_latency) {
+      m_linkStats.max_latency = latency;
+    }
+  }
+  if (state == ESP8266_LINK_CONNECTED && m_linkState == ESP8266_LINK_UP) {
+    return; /* "WIFI CONNECTED" is followed by "WIFI GOT IP", stay up */
+  }
+  m_linkState = state;
+}
+
+size_t ESP8266::tx_write(uint8_t c)
+{
+#ifndef ESP8266_USE_SOFTWARE_SERIAL
+  if (m_ctsPin != ESP8266_NO_PIN && digitalRead(m_ctsPin) == HIGH) {
+    unsigned long start = millis();
+    m_uartStats.cts_waits++;
+    while (digitalRead(m_ctsPin) == HIGH) {
+      rx_available();
+      if (millis() - start > 1000) {
+        m_uartStats.cts_timeouts++;
+        break;
+      }
+    }
+  }
+#endif
+  if (m_rxRing) {
+    rx_pump();
+  }
+  if (m_trace) {
+    traceByte(ESP8266_TRACE_TX, c);
+  }
+  m_bulkBytes++;
+  return m_puart->write(c);
+}
+
+void ESP8266::traceByte(uint8_t type, uint8_t c)
+{
+  unsigned long now = micros();
+  uint32_t delta = now - m_traceLast;
+  uint32_t entry;
+  uint16_t tail;
+
+  m_traceLast = now;
+  for (;;) {
+    if (delta > ESP8266_TRACE_DELTA_MAX) {
+      /* a pause too long for one entry: up to 30 bits of it in a gap entry */
+      uint32_t gap = delta > (ESP8266_TRACE_DELTA_MAX << 8 | 0xFF) ? (ESP8266_TRACE_DELTA_MAX << 8 | 0xFF) : delta;
+      entry = (uint32_t)ESP8266_TRACE_GAP << 30 | (gap & ESP8266_TRACE_DELTA_MAX) << 8 | gap >> 22;
+      delta -= gap;
+    } else {
+      entry = (uint32_t)type << 30 | delta << 8 | c;
+    }
+    tail = m_traceHead + m_traceCount;
+    if (tail >= m_traceEntries) {
+      tail -= m_traceEntries;
+    }
+    if (m_traceCount == m_traceEntries) {
+      m_traceHead = m_traceHead + 1 == m_traceEntries ? 0 : m_traceHead + 1;
+      m_traceDropped++;
+    } else {
+      m_traceCount++;
+    }
+    memcpy(m_trace + 4 * tail, &entry, 4);
+    if ((entry >> 30) != ESP8266_TRACE_GAP) {
+      return;
+    }
   }
 }
 
@@ -555,8 +2703,8 @@ String ESP8266::recvString(String target, uint32_t timeout)
   char a;
   unsigned long start = millis();
   while (millis() - start < timeout) {
-    while (m_puart->available() > 0) {
-      a = m_puart->read();
+    while (rx_available() > 0) {
+      a = rx_read();
       if (a == '\0') continue;
       data += a;
     }
@@ -573,8 +2721,8 @@ String ESP8266::recvString(String target1, String target2, uint32_t timeout)
   char a;
   unsigned long start = millis();
   while (millis() - start < timeout) {
-    while (m_puart->available() > 0) {
-      a = m_puart->read();
+    while (rx_available() > 0) {
+      a = rx_read();
       if (a == '\0') continue;
       data += a;
     }
@@ -593,8 +2741,8 @@ String ESP8266::recvString(String target1, String target2, String target3, uint3
   char a;
   unsigned long start = millis();
   while (millis() - start < timeout) {
-    while (m_puart->available() > 0) {
-      a = m_puart->read();
+    while (rx_available() > 0) {
+      a = rx_read();
       if (a == '\0') continue;
       data += a;
     }
@@ -619,6 +2767,82 @@ bool ESP8266::recvFind(String target, uint32_t timeout)
   return false;
 }
 
+String ESP8266::recvStringTimed(uint8_t cmd_class, String target1, String target2, String target3)
+{
+  String data;
+  unsigned long start = millis();
+  if (target3.length() > 0) {
+    data = recvString(target1, target2, target3, m_timeouts[cmd_class].rto);
+  } else {
+    data = recvString(target1, target2, m_timeouts[cmd_class].rto);
+  }
+  if (data.indexOf(target1) != -1 || data.indexOf(target2) != -1
+      || (target3.length() > 0 && data.indexOf(target3) != -1)) {
+    timeoutSample(cmd_class, millis() - start);
+  } else {
+    timeoutExpired(cmd_class);
+  }
+  return data;
+}
+
+bool ESP8266::recvFindTimed(String target, uint8_t cmd_class, uint32_t len)
+{
+  uint32_t extra = len / ESP8266_SEND_BYTES_PER_MS;
+  unsigned long start = millis();
+  uint32_t elapsed;
+  String data = recvString(target, "ERROR", "FAIL", m_timeouts[cmd_class].rto + extra);
+  elapsed = millis() - start;
+  elapsed = elapsed > extra ? elapsed - extra : 0;
+  if (data.indexOf(target) != -1) {
+    timeoutSample(cmd_class, elapsed);
+    return true;
+  }
+  if (data.indexOf("ERROR") != -1 || data.indexOf("FAIL") != -1) {
+    /* answered, only not with success */
+    timeoutSample(cmd_class, elapsed);
+  } else {
+    timeoutExpired(cmd_class);
+  }
+  return false;
+}
+
+void ESP8266::timeoutSample(uint8_t cmd_class, uint32_t elapsed)
+{
+  ESP8266Timeout *t = &m_timeouts[cmd_class];
+  uint32_t rto;
+  if (elapsed > 0xFFFF) {
+    elapsed = 0xFFFF;
+  }
+  if (t->samples == 0) {
+    t->srtt = elapsed;
+    t->rttvar = elapsed / 2;
+  } else {
+    uint32_t delta = elapsed > t->srtt ? elapsed - t->srtt : t->srtt - elapsed;
+    t->rttvar = (3UL * t->rttvar + delta) / 4;
+    t->srtt = (7UL * t->srtt + elapsed) / 8;
+  }
+  if (t->samples < 0xFFFF) {
+    t->samples++;
+  }
+  rto = t->srtt + 4UL * t->rttvar;
+  if (rto < t->floor) {
+    rto = t->floor;
+  } else if (rto > t->ceiling) {
+    rto = t->ceiling;
+  }
+  t->rto = rto;
+}
+
+void ESP8266::timeoutExpired(uint8_t cmd_class)
+{
+  ESP8266Timeout *t = &m_timeouts[cmd_class];
+  uint32_t rto = 2UL * t->rto;
+  t->rto = rto > t->ceiling ? t->ceiling : rto;
+  if (t->expired < 0xFFFF) {
+    t->expired++;
+  }
+}
+
 bool ESP8266::recvFindAndFilter(String target, String begin, String end, String & data, uint32_t timeout)
 {
   String data_tmp;
@@ -636,24 +2860,66 @@ bool ESP8266::recvFindAndFilter(String target, String begin, String end, String
   return false;
 }
 
+bool ESP8266::qATSupported(const char *query)
+{
+  String data;
+  rx_empty();
+  m_tx.println(query);
+  /* firmware before AT 0.20 answers unknown commands by "no this fun" */
+  data = recvString("OK", "ERROR", "no this fun");
+  return data.indexOf("OK") != -1;
+}
+
 bool ESP8266::eAT(void)
 {
   rx_empty();
-  m_puart->println("AT");
+  m_tx.println("AT");
   return recvFind("OK");
 }
 
 bool ESP8266::eATRST(void)
 {
   rx_empty();
-  m_puart->println("AT+RST");
+  m_tx.println("AT+RST");
   return recvFind("OK");
 }
 
+/* How often recvReady asks "AT" while it waits for the banner, ms */
+#define READY_POLL_INTERVAL 100
+
+bool ESP8266::recvReady(uint32_t timeout)
+{
+  unsigned long start = millis();
+  unsigned long polled = start;
+  uint8_t ready = 0;
+  uint8_t ok = 0;
+  char c;
+
+  /*
+   * the boot messages before the banner are at 74880 baud, so look for "ready" only,
+   * and for the "OK" to the "AT" asked meanwhile of firmware which prints no banner
+   */
+  while (millis() - start < timeout) {
+    if (millis() - polled >= READY_POLL_INTERVAL) {
+      m_tx.println("AT");
+      polled = millis();
+    }
+    while (rx_available() > 0) {
+      c = rx_read();
+      ready = c == "ready"[ready] ? ready + 1 : (c == 'r' ? 1 : 0);
+      ok = c == "OK"[ok] ? ok + 1 : (c == 'O' ? 1 : 0);
+      if (ready == 5 || ok == 2) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 bool ESP8266::eATGMR(String & version)
 {
   rx_empty();
-  m_puart->println("AT+GMR");
+  m_tx.println("AT+GMR");
   return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", version);
 }
 
@@ -664,11 +2930,30 @@ bool ESP8266::qATCWMODE(uint8_t *mode)
   if (!mode) {
     return false;
   }
+  if (cacheGet(ESP8266_CACHE_MODE)) {
+    *mode = m_cacheMode;
+    return true;
+  }
+  if (m_caps & ESP8266_CAP_CUR) {
+    /* AT+CWMODE? may report the mode saved in flash rather than the current one */
+    rx_empty();
+    m_tx.println("AT+CWMODE_CUR?");
+    if (recvFindAndFilter("OK", "+CWMODE_CUR:", "\r\n\r\nOK", str_mode)) {
+      *mode = m_cacheMode = (uint8_t)str_mode.toInt();
+      m_cacheValid |= ESP8266_CACHE_MODE;
+      return true;
+    }
+    if (m_caps & ESP8266_CAP_PROBED) {
+      return false;
+    }
+    m_caps &= ~ESP8266_CAP_CUR;
+  }
   rx_empty();
-  m_puart->println("AT+CWMODE?");
+  m_tx.println("AT+CWMODE?");
   ret = recvFindAndFilter("OK", "+CWMODE:", "\r\n\r\nOK", str_mode);
   if (ret) {
-    *mode = (uint8_t)str_mode.toInt();
+    *mode = m_cacheMode = (uint8_t)str_mode.toInt();
+    m_cacheValid |= ESP8266_CACHE_MODE;
     return true;
   } else {
     return false;
@@ -679,8 +2964,8 @@ bool ESP8266::sATCWMODE(uint8_t mode)
 {
   String data;
   rx_empty();
-  m_puart->print("AT+CWMODE=");
-  m_puart->println(mode);
+  m_tx.print("AT+CWMODE=");
+  m_tx.println(mode);
 
   data = recvString("OK", "no change");
   if (data.indexOf("OK") != -1 || data.indexOf("no change") != -1) {
@@ -689,28 +2974,228 @@ bool ESP8266::sATCWMODE(uint8_t mode)
   return false;
 }
 
-bool ESP8266::sATCWJAP(String ssid, String pwd)
+bool ESP8266::sATCWMODECUR(uint8_t mode)
+{
+  String data;
+  rx_empty();
+  m_tx.print("AT+CWMODE_CUR=");
+  m_tx.println(mode);
+
+  data = recvString("OK", "ERROR");
+  if (data.indexOf("OK") != -1) {
+    return true;
+  }
+  return false;
+}
+
+bool ESP8266::sATCWJAP(String ssid, String pwd, const uint8_t *bssid)
 {
   String data;
   rx_empty();
-  m_puart->print("AT+CWJAP=\"");
-  m_puart->print(ssid);
-  m_puart->print("\",\"");
-  m_puart->print(pwd);
-  m_puart->println("\"");
+  joinSend(ssid, pwd, bssid);
 
-  data = recvString("OK", "FAIL", 10000);
+  /* firmware without the bssid parameter answers ERROR */
+  data = recvStringTimed(bssid ? ESP8266_CMD_JOIN_BSSID : ESP8266_CMD_JOIN, "OK", "FAIL", bssid ? "ERROR" : "");
   if (data.indexOf("OK") != -1) {
+    joinDone(ssid);
     return true;
   }
   return false;
 }
 
+void ESP8266::joinSend(const String &ssid, const String &pwd, const uint8_t *bssid)
+{
+  m_tx.print("AT+CWJAP=\"");
+  m_tx.print(ssid);
+  m_tx.print("\",\"");
+  m_tx.print(pwd);
+  if (bssid) {
+    m_tx.print("\",\"");
+    for (uint8_t i = 0; i < 6; i++) {
+      if (i > 0) {
+        m_tx.print(":");
+      }
+      m_tx.print("0123456789abcdef"[bssid[i] >> 4]);
+      m_tx.print("0123456789abcdef"[bssid[i] & 0x0F]);
+    }
+  }
+  m_tx.println("\"");
+}
+
+void ESP8266::joinDone(const String &ssid)
+{
+  linkSet(ESP8266_LINK_UP);
+  cacheDrop(ESP8266_CACHE_ADDR);
+  ssid.toCharArray(m_cacheSSID, sizeof(m_cacheSSID));
+  m_cacheValid |= ESP8266_CACHE_AP;
+}
+
+/* +CWJAP:"<ssid>","<bssid>",<channel>,<rssi> or No AP */
+bool ESP8266::qATCWJAP(String & ssid)
+{
+  String data;
+  if (cacheGet(ESP8266_CACHE_AP)) {
+    ssid = m_cacheSSID;
+    return ssid.length() > 0;
+  }
+  rx_empty();
+  m_tx.println("AT+CWJAP?");
+  data = recvString("OK", "ERROR");
+  if (data.indexOf("OK") == -1) {
+    ssid = "";
+    return false;
+  }
+  /* "No AP" is cached as an empty SSID */
+  if (!quotedField(data, "+CWJAP:\"", m_cacheSSID, sizeof(m_cacheSSID))) {
+    m_cacheSSID[0] = '\0';
+  }
+  m_cacheValid |= ESP8266_CACHE_AP;
+  ssid = m_cacheSSID;
+  return ssid.length() > 0;
+}
+
+/* +CWJAP:"<ssid>","<bssid>",<channel>,<rssi> */
+bool ESP8266::qATCWJAP(ESP8266AP *ap)
+{
+  String data;
+  int index;
+  rx_empty();
+  m_tx.println("AT+CWJAP?");
+  data = recvString("OK", "ERROR");
+  index = data.indexOf("+CWJAP:");
+  if (data.indexOf("OK") == -1 || index == -1) {
+    return false;
+  }
+  data = data.substring(index + 7, data.indexOf('\r', index));
+  index = 0;
+  if (!quotedField(data, "\"", m_cacheSSID, sizeof(m_cacheSSID))) {
+    return false;
+  }
+  m_cacheValid |= ESP8266_CACHE_AP;
+  nextField(data, index);
+  if (!parseMAC(nextField(data, index), ap->bssid)) {
+    return false;
+  }
+  ap->channel = nextField(data, index).toInt();
+  ap->rssi = nextField(data, index).toInt();
+  ap->ecn = 0;
+  return true;
+}
+
+/* "a.b.c.d" */
+static bool parseIP(const String &text, uint8_t *ip)
+{
+  int index = 0;
+  int dot;
+  for (uint8_t i = 0; i < 4; i++) {
+    dot = i < 3 ? text.indexOf('.', index) : text.length();
+    if (dot <= index || dot - index > 3) {
+      return false;
+    }
+    ip[i] = (uint8_t)text.substring(index, dot).toInt();
+    index = dot + 1;
+  }
+  return true;
+}
+
+static void printIP(Print &out, const uint8_t *ip)
+{
+  out.print("\"");
+  for (uint8_t i = 0; i < 4; i++) {
+    if (i > 0) {
+      out.print(".");
+    }
+    out.print(ip[i]);
+  }
+  out.print("\"");
+}
+
+bool ESP8266::sATCIPADDR(const char *iface, const ESP8266IPConfig &config)
+{
+  String data;
+  rx_empty();
+  m_tx.print("AT+CIP");
+  m_tx.print(iface);
+  m_tx.print(m_caps & ESP8266_CAP_CUR ? "_CUR=" : "=");
+  printIP(m_tx, config.ip);
+  m_tx.print(",");
+  printIP(m_tx, config.gateway);
+  m_tx.print(",");
+  printIP(m_tx, config.netmask);
+  m_tx.println();
+  data = recvString("OK", "ERROR");
+  if (data.indexOf("OK") == -1) {
+    return false;
+  }
+  cacheDrop(ESP8266_CACHE_ADDR);
+  return true;
+}
+
+/* +CIPSTA_CUR:ip:"<ip>" +CIPSTA_CUR:gateway:"<gateway>" +CIPSTA_CUR:netmask:"<netmask>", or +CIPSTA:"<ip>" */
+bool ESP8266::qATCIPADDR(const char *iface, ESP8266IPConfig *config)
+{
+  String data;
+  char text[16];
+  if (!config) {
+    return false;
+  }
+  rx_empty();
+  m_tx.print("AT+CIP");
+  m_tx.print(iface);
+  m_tx.println(m_caps & ESP8266_CAP_CUR ? "_CUR?" : "?");
+  data = recvString("OK", "ERROR");
+  if (data.indexOf("OK") == -1) {
+    return false;
+  }
+  memset(config, 0, sizeof(*config));
+  if (!quotedField(data, "ip:\"", text, sizeof(text)) && !quotedField(data, "\"", text, sizeof(text))) {
+    return false;
+  }
+  if (!parseIP(text, config->ip)) {
+    return false;
+  }
+  if (quotedField(data, "gateway:\"", text, sizeof(text))) {
+    parseIP(text, config->gateway);
+  }
+  if (quotedField(data, "netmask:\"", text, sizeof(text))) {
+    parseIP(text, config->netmask);
+  }
+  return true;
+}
+
+bool ESP8266::sATCWDHCP(uint8_t mode, uint8_t enable)
+{
+  String data;
+  rx_empty();
+  m_tx.print(m_caps & ESP8266_CAP_CUR ? "AT+CWDHCP_CUR=" : "AT+CWDHCP=");
+  m_tx.print(mode);
+  m_tx.print(",");
+  m_tx.println(enable);
+  data = recvString("OK", "ERROR");
+  if (data.indexOf("OK") == -1) {
+    return false;
+  }
+  cacheDrop(ESP8266_CACHE_ADDR);
+  return true;
+}
+
+bool ESP8266::sATCWLAPOPT(uint8_t sort, uint16_t mask)
+{
+  String data;
+  rx_empty();
+  m_tx.print("AT+CWLAPOPT=");
+  m_tx.print(sort);
+  m_tx.print(",");
+  m_tx.println(mask);
+  data = recvString("OK", "ERROR");
+  return data.indexOf("OK") != -1;
+}
+
 bool ESP8266::eATCWLAP(String & list)
 {
   String data;
   rx_empty();
-  m_puart->println("AT+CWLAP");
+  m_tx.println("AT+CWLAP");
   return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", list, 10000);
 }
 
@@ -718,22 +3203,28 @@ bool ESP8266::eATCWQAP(void)
 {
   String data;
   rx_empty();
-  m_puart->println("AT+CWQAP");
-  return recvFind("OK");
+  m_tx.println("AT+CWQAP");
+  if (!recvFind("OK")) {
+    return false;
+  }
+  cacheDrop(ESP8266_CACHE_ADDR);
+  m_cacheSSID[0] = '\0';
+  m_cacheValid |= ESP8266_CACHE_AP;
+  return true;
 }
 
 bool ESP8266::sATCWSAP(String ssid, String pwd, uint8_t chl, uint8_t ecn)
 {
   String data;
   rx_empty();
-  m_puart->print("AT+CWSAP=\"");
-  m_puart->print(ssid);
-  m_puart->print("\",\"");
-  m_puart->print(pwd);
-  m_puart->print("\",");
-  m_puart->print(chl);
-  m_puart->print(",");
-  m_puart->println(ecn);
+  m_tx.print("AT+CWSAP=\"");
+  m_tx.print(ssid);
+  m_tx.print("\",\"");
+  m_tx.print(pwd);
+  m_tx.print("\",");
+  m_tx.print(chl);
+  m_tx.print(",");
+  m_tx.println(ecn);
 
   data = recvString("OK", "ERROR", 5000);
   if (data.indexOf("OK") != -1) {
@@ -746,7 +3237,7 @@ bool ESP8266::eATCWLIF(String & list)
 {
   String data;
   rx_empty();
-  m_puart->println("AT+CWLIF");
+  m_tx.println("AT+CWLIF");
   return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", list);
 }
 
@@ -755,23 +3246,42 @@ bool ESP8266::eATCIPSTATUS(String & list)
   String data;
   delay(100);
   rx_empty();
-  m_puart->println("AT+CIPSTATUS");
+  m_tx.println("AT+CIPSTATUS");
   return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", list);
 }
 
-bool ESP8266::sATCIPSTARTSingle(String type, String addr, uint32_t port)
+bool ESP8266::qATCIPSTATUS(uint8_t *status)
 {
   String data;
+  int32_t index;
+  if (!status) {
+    return false;
+  }
   rx_empty();
-  m_puart->print("AT+CIPSTART=\"");
-  m_puart->print(type);
-  m_puart->print("\",\"");
-  m_puart->print(addr);
-  m_puart->print("\",");
-  m_puart->println(port);
+  m_tx.println("AT+CIPSTATUS");
+  data = recvString("OK", "ERROR");
+  index = data.indexOf("STATUS:");
+  if (data.indexOf("OK") == -1 || index == -1) {
+    return false;
+  }
+  *status = (uint8_t)data.substring(index + 7).toInt();
+  return true;
+}
 
-  data = recvString("OK", "ERROR", "ALREADY CONNECT", 500);
+bool ESP8266::sATCIPSTARTSingle(String type, String addr, uint32_t port)
+{
+  String data;
+  rx_empty();
+  m_tx.print("AT+CIPSTART=\"");
+  m_tx.print(type);
+  m_tx.print("\",\"");
+  m_tx.print(addr);
+  m_tx.print("\",");
+  m_tx.println(port);
+
+  data = recvStringTimed(ESP8266_CMD_CONNECT, "OK", "ERROR", "ALREADY CONNECT");
   if (data.indexOf("OK") != -1 || data.indexOf("ALREADY CONNECT") != -1) {
+    m_udpLinks = type == "UDP" ? 1 : 0;
     return true;
   }
   return false;
@@ -782,17 +3292,67 @@ bool ESP8266::sATCIPSTARTMultiple(uint8_t mux_id, String type, String addr, uint
   String data;
   rx_empty();
   delay(50);
-  m_puart->print("AT+CIPSTART=");
-  m_puart->print(mux_id);
-  m_puart->print(",\"");
-  m_puart->print(type);
-  m_puart->print("\",\"");
-  m_puart->print(addr);
-  m_puart->print("\",");
-  m_puart->println(port);
-
-  data = recvString("OK", "ERROR", "ALREADY CONNECT", 10000);
+  m_tx.print("AT+CIPSTART=");
+  m_tx.print(mux_id);
+  m_tx.print(",\"");
+  m_tx.print(type);
+  m_tx.print("\",\"");
+  m_tx.print(addr);
+  m_tx.print("\",");
+  m_tx.println(port);
+
+  data = recvStringTimed(ESP8266_CMD_CONNECT, "OK", "ERROR", "ALREADY CONNECT");
+  if (data.indexOf("OK") != -1 || data.indexOf("ALREADY CONNECT") != -1) {
+    if (type == "UDP") {
+      m_udpLinks |= 1 << mux_id;
+    } else {
+      m_udpLinks &= ~(1 << mux_id);
+    }
+    return true;
+  }
+  return false;
+}
+
+bool ESP8266::sATCIPSTARTUDPSingle(String addr, uint32_t port, uint32_t local_port, uint8_t mode)
+{
+  String data;
+  rx_empty();
+  m_tx.print("AT+CIPSTART=\"UDP\",\"");
+  m_tx.print(addr);
+  m_tx.print("\",");
+  m_tx.print(port);
+  m_tx.print(",");
+  m_tx.print(local_port);
+  m_tx.print(",");
+  m_tx.println(mode);
+
+  data = recvStringTimed(ESP8266_CMD_CONNECT, "OK", "ERROR", "ALREADY CONNECT");
+  if (data.indexOf("OK") != -1 || data.indexOf("ALREADY CONNECT") != -1) {
+    m_udpLinks = 1;
+    return true;
+  }
+  return false;
+}
+
+bool ESP8266::sATCIPSTARTUDPMultiple(uint8_t mux_id, String addr, uint32_t port, uint32_t local_port, uint8_t mode)
+{
+  String data;
+  rx_empty();
+  delay(50);
+  m_tx.print("AT+CIPSTART=");
+  m_tx.print(mux_id);
+  m_tx.print(",\"UDP\",\"");
+  m_tx.print(addr);
+  m_tx.print("\",");
+  m_tx.print(port);
+  m_tx.print(",");
+  m_tx.print(local_port);
+  m_tx.print(",");
+  m_tx.println(mode);
+
+  data = recvStringTimed(ESP8266_CMD_CONNECT, "OK", "ERROR", "ALREADY CONNECT");
   if (data.indexOf("OK") != -1 || data.indexOf("ALREADY CONNECT") != -1) {
+    m_udpLinks |= 1 << mux_id;
     return true;
   }
   return false;
@@ -800,32 +3360,125 @@ bool ESP8266::sATCIPSTARTMultiple(uint8_t mux_id, String type, String addr, uint
 
 bool ESP8266::sATCIPSENDSingle(const uint8_t *buffer, uint32_t len)
 {
+  pace();
   rx_empty();
-  m_puart->print("AT+CIPSEND=");
-  m_puart->println(len);
-  if (recvFind(">", 5000)) {
+  m_tx.print("AT+CIPSEND=");
+  m_tx.println(len);
+  if (recvFindTimed(">", ESP8266_CMD_PROMPT)) {
     rx_empty();
     for (uint32_t i = 0; i < len; i++) {
-      m_puart->write(buffer[i]);
+      tx_write(buffer[i]);
     }
-    return recvFind("SEND OK", 10000);
+    return recvFindTimed("SEND OK", ESP8266_CMD_SEND, len);
   }
   return false;
 }
 
 bool ESP8266::sATCIPSENDMultiple(uint8_t mux_id, const uint8_t *buffer, uint32_t len)
 {
+  pace();
+  rx_empty();
+  m_tx.print("AT+CIPSEND=");
+  m_tx.print(mux_id);
+  m_tx.print(",");
+  m_tx.println(len);
+  if (recvFindTimed(">", ESP8266_CMD_PROMPT)) {
+    rx_empty();
+    for (uint32_t i = 0; i < len; i++) {
+      tx_write(buffer[i]);
+    }
+    return recvFindTimed("SEND OK", ESP8266_CMD_SEND, len);
+  }
+  return false;
+}
+bool ESP8266::sATCIPSENDStream(int8_t mux_id, uint32_t len, ESP8266SendProducer producer, void *context)
+{
+  uint8_t chunk[16];
+  uint32_t offset = 0;
+  bool dry = false;
+
+  if (producer == NULL) {
+    return false;
+  }
+  /* several AT+CIPSEND would make several datagrams */
+  if (len > ESP8266_MAX_CIPSEND && (m_udpLinks & (1 << (mux_id >= 0 ? mux_id : 0)))) {
+    return false;
+  }
+  while (offset < len) {
+    uint32_t segment = len - offset > ESP8266_MAX_CIPSEND ? ESP8266_MAX_CIPSEND : len - offset;
+    uint32_t end = offset + segment;
+
+    pace();
+    rx_empty();
+    m_tx.print("AT+CIPSEND=");
+    if (mux_id >= 0) {
+      m_tx.print(mux_id);
+      m_tx.print(",");
+    }
+    m_tx.println(segment);
+    if (!recvFindTimed(">", ESP8266_CMD_PROMPT)) {
+      return false;
+    }
+    rx_empty();
+    while (offset < end) {
+      uint16_t want = end - offset > sizeof(chunk) ? sizeof(chunk) : end - offset;
+      uint16_t got = dry ? 0 : producer(chunk, want, offset, context);
+      if (got == 0 || got > want) {
+        /* the ESP8266 waits for segment bytes: fill up with zeros and fail */
+        dry = true;
+        memset(chunk, 0, want);
+        got = want;
+      }
+      for (uint16_t i = 0; i < got; i++) {
+        tx_write(chunk[i]);
+      }
+      offset += got;
+    }
+    if (!recvFindTimed("SEND OK", ESP8266_CMD_SEND, segment) || dry) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ESP8266::sATCIPSENDSingleTo(const uint8_t *buffer, uint32_t len, String addr, uint32_t port)
+{
+  pace();
+  rx_empty();
+  m_tx.print("AT+CIPSEND=");
+  m_tx.print(len);
+  m_tx.print(",\"");
+  m_tx.print(addr);
+  m_tx.print("\",");
+  m_tx.println(port);
+  if (recvFindTimed(">", ESP8266_CMD_PROMPT)) {
+    rx_empty();
+    for (uint32_t i = 0; i < len; i++) {
+      tx_write(buffer[i]);
+    }
+    return recvFindTimed("SEND OK", ESP8266_CMD_SEND, len);
+  }
+  return false;
+}
+
+bool ESP8266::sATCIPSENDMultipleTo(uint8_t mux_id, const uint8_t *buffer, uint32_t len, String addr, uint32_t port)
+{
+  pace();
   rx_empty();
-  m_puart->print("AT+CIPSEND=");
-  m_puart->print(mux_id);
-  m_puart->print(",");
-  m_puart->println(len);
-  if (recvFind(">", 5000)) {
+  m_tx.print("AT+CIPSEND=");
+  m_tx.print(mux_id);
+  m_tx.print(",");
+  m_tx.print(len);
+  m_tx.print(",\"");
+  m_tx.print(addr);
+  m_tx.print("\",");
+  m_tx.println(port);
+  if (recvFindTimed(">", ESP8266_CMD_PROMPT)) {
     rx_empty();
     for (uint32_t i = 0; i < len; i++) {
-      m_puart->write(buffer[i]);
+      tx_write(buffer[i]);
     }
-    return recvFind("SEND OK", 10000);
+    return recvFindTimed("SEND OK", ESP8266_CMD_SEND, len);
   }
   return false;
 }
@@ -833,10 +3486,10 @@ bool ESP8266::sATCIPCLOSEMulitple(uint8_t mux_id)
 {
   String data;
   rx_empty();
-  m_puart->print("AT+CIPCLOSE=");
-  m_puart->println(mux_id);
+  m_tx.print("AT+CIPCLOSE=");
+  m_tx.println(mux_id);
 
-  data = recvString("OK", "link is not", 5000);
+  data = recvStringTimed(ESP8266_CMD_CLOSE, "OK", "link is not");
   if (data.indexOf("OK") != -1 || data.indexOf("link is not") != -1) {
     return true;
   }
@@ -846,13 +3499,13 @@ bool ESP8266::eATCIPCLOSESingle(void)
 {
 
   rx_empty();
-  m_puart->println("AT+CIPCLOSE");
-  return recvFind("OK", 5000);
+  m_tx.println("AT+CIPCLOSE");
+  return recvFindTimed("OK", ESP8266_CMD_CLOSE);
 }
 bool ESP8266::eATCIFSR(String & list)
 {
   rx_empty();
-  m_puart->println("AT+CIFSR");
+  m_tx.println("AT+CIFSR");
   return recvFindAndFilter("OK", "\r\r\n", "\r\n\r\nOK", list);
 }
 bool ESP8266::sATCIPMUX(uint8_t mode)
@@ -861,12 +3514,33 @@ bool ESP8266::sATCIPMUX(uint8_t mode)
 
   rx_empty();
   delay(100);
-  m_puart->print("AT+CIPMUX=");
-  m_puart->println(mode);
+  m_tx.print("AT+CIPMUX=");
+  m_tx.println(mode);
 
   data = recvString("OK", "Link is builded");
   if (data.indexOf("OK") != -1) {
     delay(100);
+    m_cacheMux = mode;
+    m_cacheValid |= ESP8266_CACHE_MUX;
+    return true;
+  }
+  return false;
+}
+bool ESP8266::qATCIPMUX(uint8_t *mode)
+{
+  String str_mode;
+  if (!mode) {
+    return false;
+  }
+  if (cacheGet(ESP8266_CACHE_MUX)) {
+    *mode = m_cacheMux;
+    return true;
+  }
+  rx_empty();
+  m_tx.println("AT+CIPMUX?");
+  if (recvFindAndFilter("OK", "+CIPMUX:", "\r\n\r\nOK", str_mode)) {
+    *mode = m_cacheMux = (uint8_t)str_mode.toInt();
+    m_cacheValid |= ESP8266_CACHE_MUX;
     return true;
   }
   return false;
@@ -876,41 +3550,174 @@ bool ESP8266::sATCIPSERVER(uint8_t mode, uint32_t port)
   String data;
   if (mode) {
     rx_empty();
-    m_puart->print("AT+CIPSERVER=1,");
-    m_puart->println(port);
+    m_tx.print("AT+CIPSERVER=1,");
+    m_tx.println(port);
 
     data = recvString("OK", "no change");
     if (data.indexOf("OK") != -1 || data.indexOf("no change") != -1) {
+      m_cachePort = port;
+      m_cacheValid |= ESP8266_CACHE_SERVER;
       return true;
     }
     return false;
   } else {
     rx_empty();
-    m_puart->println("AT+CIPSERVER=0");
-    return recvFind("\r\r\n");
+    m_tx.println("AT+CIPSERVER=0");
+    if (!recvFind("\r\r\n")) {
+      return false;
+    }
+    m_cachePort = 0;
+    m_cacheValid |= ESP8266_CACHE_SERVER;
+    return true;
   }
 }
 bool ESP8266::sATCIPSTO(uint32_t timeout)
 {
   rx_empty();
-  m_puart->print("AT+CIPSTO=");
-  m_puart->println(timeout);
+  m_tx.print("AT+CIPSTO=");
+  m_tx.println(timeout);
+  return recvFind("OK");
+}
+bool ESP8266::sATCIPDINFO(uint8_t mode)
+{
+  rx_empty();
+  m_tx.print("AT+CIPDINFO=");
+  m_tx.println(mode);
+  return recvFind("OK");
+}
+bool ESP8266::sATUARTCUR(uint32_t baud, uint8_t flow_control)
+{
+  rx_empty();
+  m_tx.print("AT+UART_CUR=");
+  m_tx.print(baud);
+  m_tx.print(",8,1,0,");
+  m_tx.println(flow_control);
+  return recvFind("OK");
+}
+bool ESP8266::sATSLEEP(uint8_t mode)
+{
+  rx_empty();
+  m_tx.print("AT+SLEEP=");
+  m_tx.println(mode);
+  return recvFind("OK");
+}
+bool ESP8266::sATWAKEUPGPIO(uint8_t enable, uint8_t gpio, uint8_t level)
+{
+  rx_empty();
+  m_tx.print("AT+WAKEUPGPIO=");
+  m_tx.print(enable);
+  m_tx.print(",");
+  m_tx.print(gpio);
+  m_tx.print(",");
+  m_tx.println(level);
+  return recvFind("OK");
+}
+bool ESP8266::sATGSLP(uint32_t time)
+{
+  rx_empty();
+  m_tx.print("AT+GSLP=");
+  m_tx.println(time);
+  return recvFind("OK");
+}
+bool ESP8266::sATCIPRECVMODE(uint8_t mode)
+{
+  rx_empty();
+  m_tx.print("AT+CIPRECVMODE=");
+  m_tx.println(mode);
   return recvFind("OK");
 }
+/* +CIPRECVDATA,<actual_len>:<data> or +CIPRECVDATA:<actual_len>,<data>, depending on the firmware */
+uint32_t ESP8266::sATCIPRECVDATA(int8_t mux_id, uint8_t *buffer, uint32_t len)
+{
+  String data;
+  char a;
+  uint32_t actual = 0;
+  uint32_t i = 0;
+  bool has_len = false;
+  unsigned long start;
+
+  rx_empty();
+  m_tx.print("AT+CIPRECVDATA=");
+  if (mux_id >= 0) {
+    m_tx.print(mux_id);
+    m_tx.print(",");
+  }
+  m_tx.println(len);
+
+  start = millis();
+  while (millis() - start < 3000 && !has_len) {
+    if (rx_available() > 0) {
+      a = rx_read();
+      data += a;
+      /* at the start of a line, so the echo "AT+CIPRECVDATA=<id>,<len>" does not match */
+      int32_t index = data.startsWith("+CIPRECVDATA") ? 0 : data.indexOf("\n+CIPRECVDATA") + 1;
+      /* skip the first separator, then the digits end at the second one */
+      if (index != 0 || data.startsWith("+CIPRECVDATA")) {
+        if ((int32_t)data.length() > index + 13 && (a < '0' || a > '9')) {
+          actual = data.substring(index + 13).toInt();
+          has_len = true;
+        }
+      }
+    }
+    if (data.indexOf("ERROR") != -1) {
+      return 0;
+    }
+  }
+  if (!has_len) {
+    return 0;
+  }
+
+  /* the data is not scanned for notifications, the line after it starts afresh */
+  m_linkLineLen = 0;
+  start = millis();
+  while (millis() - start < 3000 && i < actual) {
+    if (rx_available() > 0) {
+      a = rx_readPayload();
+      if (i < len) {
+        buffer[i] = a;
+      }
+      i++;
+    }
+  }
+  recvFind("OK");
+  return i < len ? i : len;
+}
+/* +CIPRECVLEN:<len0>,<len1>,<len2>,<len3>,<len4> */
+bool ESP8266::qATCIPRECVLEN(void)
+{
+  String list;
+  int32_t index = 0;
+  rx_empty();
+  m_tx.println("AT+CIPRECVLEN?");
+  if (!recvFindAndFilter("OK", "+CIPRECVLEN:", "\r\n\r\nOK", list)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < 5; i++) {
+    m_passivePending[i] = list.substring(index).toInt();
+    index = list.indexOf(',', index);
+    if (index == -1) {
+      break;
+    }
+    index++;
+  }
+  m_passiveSync = false;
+  return true;
+}
 
 
 
 bool ESP8266::sendSingle(const char* url)
 {
+  flush();
   rx_empty();
-  m_puart->print("AT+CIPSEND=");
-  m_puart->println(strlen(url));
-  if (recvFind(">", 500)) {
+  m_tx.print("AT+CIPSEND=");
+  m_tx.println(strlen(url));
+  if (recvFindTimed(">", ESP8266_CMD_PROMPT)) {
     rx_empty();
-    m_puart->print(url);
+    m_tx.print(url);
 
 
-    return recvFind("SEND OK", 500);
+    return recvFindTimed("SEND OK", ESP8266_CMD_SEND, strlen(url));
   }
   else
     return false;
@@ -927,19 +3734,19 @@ String inData = "";
 
   unsigned long start = millis();
   while (millis() - start < 500) {
-    while (m_puart->available() > 0 && i < bufferLen)
+    while (rx_available() > 0 && i < bufferLen)
     {
       //when using software serial due to buffer issues read incoming string char by char
 #ifdef ESP8266_USE_SOFTWARE_SERIAL
-      char c = m_puart->read();
+      char c = rx_read();
       buffer[i++] = c;
 #else
-      inData += m_puart->readStringUntil('\n');
+      inData += rx_readStringUntil('\n');
 
 #endif
     }
 
-    if (i == bufferLen && m_puart->available()) {
+    if (i == bufferLen && rx_available()) {
       Serial.println(F("buffer is full!"));
       return i - 1;
     }
@@ -988,4 +3795,4 @@ int ESP8266::httpGet()
 
 
 
-
+
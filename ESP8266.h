@@ -32,6 +32,352 @@
 #include "SoftwareSerial.h"
 #endif
 
+/* Pin number meaning "not connected" for the flow control lines */
+#define ESP8266_NO_PIN  0xFF
+
+/* Hold RTS(stop the ESP8266) when this many bytes wait in the UART RX buffer */
+#define ESP8266_RTS_HIGH_WATER  48
+
+/*
+ * Trace entries are 32 bit: type(2 bits) | microseconds since the previous entry(22 bits) | byte. 
+ * A longer pause is written first as ESP8266_TRACE_GAP entries, whose byte holds 8 more bits of time. 
+ */
+#define ESP8266_TRACE_RX        0
+#define ESP8266_TRACE_TX        1
+#define ESP8266_TRACE_GAP       2
+#define ESP8266_TRACE_DELTA_MAX 0x3FFFFFUL
+
+/* Most bytes one AT+CIPSEND takes, longer streamed sends are split */
+#define ESP8266_MAX_CIPSEND     2048
+
+/* Capabilities of the AT firmware, bits of getCapabilities(0x02..0x08 and 0x20 unused) */
+#define ESP8266_CAP_CUR         0x01    /* AT+CWMODE_CUR and the other _CUR commands */
+#define ESP8266_CAP_CIPRECVMODE 0x10    /* AT+CIPRECVMODE, passive receive */
+#define ESP8266_CAP_UART_CUR    0x40    /* AT+UART_CUR */
+#define ESP8266_CAP_PROBED      0x80    /* the other bits were probed, not assumed */
+
+/**
+ * Produces the data of a streamed send.
+ *
+ * Called inside AT+CIPSEND with a small buffer, whatever it writes goes to the UART at once. 
+ *
+ * @param buffer - where to put the next bytes.
+ * @param size - the most bytes wanted now.
+ * @param offset - how many bytes were produced before.
+ * @param context - the pointer given to send.
+ * @return the number of bytes put in buffer, 0 if no more data can be produced.
+ */
+typedef uint16_t (*ESP8266SendProducer)(uint8_t *buffer, uint16_t size, uint32_t offset, void *context);
+
+/**
+ * Takes the pieces of recvPieces.
+ *
+ * @param data - the piece, may be changed in place.
+ * @param len - the length of the piece.
+ * @param context - the pointer given to recvPieces.
+ */
+typedef void (*ESP8266RecvSink)(uint8_t *data, uint16_t len, void *context);
+
+/**
+ * One piece of a scatter-gather send. 
+ */
+struct ESP8266Segment {
+    const uint8_t *data;    /* the bytes, in RAM or in flash(PROGMEM) */
+    uint16_t len;           /* the length of data */
+    bool progmem;           /* data is in flash */
+};
+
+
+/**
+ * Classes of AT commands sharing one adaptive timeout. 
+ */
+enum ESP8266CmdClass {
+    ESP8266_CMD_CONNECT = 0,    /* AT+CIPSTART */
+    ESP8266_CMD_PROMPT,         /* ">" after AT+CIPSEND */
+    ESP8266_CMD_SEND,           /* "SEND OK" after the payload */
+    ESP8266_CMD_JOIN,           /* AT+CWJAP, scanning for the SSID */
+    ESP8266_CMD_CLOSE,          /* AT+CIPCLOSE */
+    ESP8266_CMD_JOIN_BSSID,     /* AT+CWJAP to a known BSSID, much faster without the scan */
+    ESP8266_CMD_CLASSES
+};
+
+/**
+ * Adaptive timeout of one command class, all values in ms. 
+ *
+ * Estimated like the TCP RTO(RFC 6298): rto = srtt + 4 * rttvar, clamped to [floor, ceiling] 
+ * and doubled on every expiry until the next response is measured. 
+ */
+struct ESP8266Timeout {
+    uint16_t srtt;      /* smoothed response time */
+    uint16_t rttvar;    /* response time variation */
+    uint16_t rto;       /* the timeout used for the next command */
+    uint16_t floor;
+    uint16_t ceiling;
+    uint16_t samples;   /* responses measured */
+    uint16_t expired;   /* commands which timed out */
+};
+
+/* Payload bytes per ms the "SEND OK" timeout adds to the estimate, which covers the rest */
+#define ESP8266_SEND_BYTES_PER_MS   8
+
+/**
+ * Operations guarded by a retry policy. 
+ */
+enum ESP8266PolicyOp {
+    ESP8266_OP_INIT = 0,    /* baud, operation mode and MUX setup */
+    ESP8266_OP_JOIN,        /* AT+CWJAP */
+    ESP8266_OP_CONNECT,     /* AT+CIPSTART */
+    ESP8266_OP_USER,        /* free for the application */
+    ESP8266_OP_CLASSES
+};
+
+/**
+ * Results of the policy-guarded methods. 
+ */
+enum ESP8266Status {
+    ESP8266_SUCCESS = 0,    /* the operation succeeded */
+    ESP8266_FAILURE,        /* the operation was tried and failed, a retry is scheduled */
+    ESP8266_BACKOFF,        /* not tried: waiting for the retry time */
+    ESP8266_BREAKER_OPEN,   /* not tried: too many failures, the circuit is open */
+    ESP8266_PENDING         /* one step succeeded, call again to continue */
+};
+
+/**
+ * States of the circuit breaker. 
+ */
+enum ESP8266CircuitState {
+    ESP8266_CIRCUIT_CLOSED = 0, /* attempts allowed */
+    ESP8266_CIRCUIT_OPEN,       /* attempts rejected until open_time passed */
+    ESP8266_CIRCUIT_HALF_OPEN   /* one trial allowed, its result closes or reopens */
+};
+
+/**
+ * Retry policy and statistics of one operation. 
+ *
+ * After a failure the next attempt waits base_delay * 2^(failures - 1), capped to max_delay, 
+ * with random jitter of up to half the delay. After max_failures consecutive failures the 
+ * circuit opens for open_time. 
+ */
+struct ESP8266Policy {
+    uint8_t max_failures;
+    uint16_t base_delay;        /* ms */
+    uint16_t max_delay;         /* ms */
+    uint32_t open_time;         /* ms */
+    uint8_t state;              /* one of ESP8266CircuitState */
+    uint8_t consecutive;        /* failures since the last success */
+    unsigned long next_attempt; /* millis() before which attempts are rejected */
+    uint16_t attempts;
+    uint16_t failures;
+    uint16_t retries;           /* attempts following a failure */
+    uint16_t trips;             /* times the circuit opened */
+};
+
+/**
+ * Startup timing of fastInit, all values in ms. 
+ */
+struct ESP8266BootTiming {
+    uint16_t baud;      /* finding or setting the baud rate, and probing the capabilities */
+    uint16_t mode;      /* checking or setting the operation mode */
+    uint16_t join;      /* checking the connection or joining the AP */
+    uint16_t mux;       /* checking or setting single connection mode */
+    uint16_t total;
+    uint8_t skipped;    /* steps already satisfied: bit 0 baud, 1 mode, 2 join, 3 mux */
+};
+
+/**
+ * States of the Wi-Fi station link. 
+ */
+enum ESP8266LinkState {
+    ESP8266_LINK_UNKNOWN = 0,   /* not probed yet */
+    ESP8266_LINK_DOWN,          /* not joined in any AP */
+    ESP8266_LINK_CONNECTED,     /* joined, waiting for an IP */
+    ESP8266_LINK_UP             /* joined and got an IP */
+};
+
+/**
+ * Statistics of the Wi-Fi link supervisor, times in ms. 
+ */
+struct ESP8266LinkStats {
+    uint16_t disconnects;       /* times the link went down */
+    uint16_t reconnects;        /* times the link came back up */
+    uint32_t down_time;         /* total time spent down, until the last reconnect */
+    uint32_t last_latency;      /* time from the last disconnect to the reconnect */
+    uint32_t max_latency;       /* longest time from disconnect to reconnect */
+};
+
+/**
+ * An access point found by findAP. 
+ */
+struct ESP8266AP {
+    uint8_t bssid[6];
+    int8_t rssi;            /* dBm */
+    uint8_t channel;
+    uint8_t ecn;            /* 0 open, 1 WEP, 2 WPA_PSK, 3 WPA2_PSK, 4 WPA_WPA2_PSK */
+};
+
+/**
+ * The AP joinAPFast joins directly. Save it, e.g. in EEPROM, to join fast after a reset too. 
+ */
+struct ESP8266FastJoin {
+    uint8_t bssid[6];
+    uint8_t channel;        /* 0 if nothing is remembered */
+    uint16_t ssid_hash;     /* of the SSID the BSSID belongs to */
+};
+
+/**
+ * Statistics of joinAPFast, times in ms. 
+ */
+struct ESP8266JoinStats {
+    uint16_t fast;          /* joins of the remembered BSSID */
+    uint16_t scanned;       /* joins of the strongest BSSID found by a targeted scan */
+    uint16_t full;          /* joins by a plain AT+CWJAP, which scans all channels */
+    uint16_t failed;        /* joinAPFast calls which failed */
+    uint32_t last_latency;  /* of the last successful joinAPFast */
+    uint32_t max_latency;
+};
+
+/**
+ * IPv4 addressing of the station or the softAP, a.b.c.d kept as {a, b, c, d}. 
+ */
+struct ESP8266IPConfig {
+    uint8_t ip[4];
+    uint8_t gateway[4];
+    uint8_t netmask[4];
+};
+
+/* Interfaces of setDHCP */
+#define ESP8266_DHCP_SOFTAP     0
+#define ESP8266_DHCP_STATION    1
+#define ESP8266_DHCP_BOTH       2
+
+/* Parts of the module state cached by the library */
+#define ESP8266_CACHE_MODE      0x01    /* operation mode */
+#define ESP8266_CACHE_MUX       0x02    /* AT+CIPMUX */
+#define ESP8266_CACHE_SERVER    0x04    /* TCP server port, 0 if stopped */
+#define ESP8266_CACHE_ADDR      0x08    /* local IP and MAC */
+#define ESP8266_CACHE_AP        0x10    /* SSID of the joined AP */
+#define ESP8266_CACHE_ALL       0x1F
+
+/**
+ * Counters of the module state cache. 
+ */
+struct ESP8266CacheStats {
+    uint32_t hits;              /* answered from the cache, without a command */
+    uint32_t misses;            /* asked the module */
+    uint16_t invalidations;     /* times cached state was dropped by a notification or restart */
+};
+
+/**
+ * Link quality measured by the monitor, times in ms. 
+ *
+ * Averages are smoothed like ESP8266Timeout: a new sample weighs 1/8, the deviation 1/4. 
+ */
+struct ESP8266LinkQuality {
+    int8_t rssi;            /* the last RSSI in dBm, 0 if not joined */
+    int8_t rssi_avg;        /* smoothed RSSI */
+    int8_t rssi_min;        /* weakest RSSI measured */
+    uint16_t rtt;           /* the last ping round trip time, 0 if it was lost */
+    uint16_t rtt_avg;       /* smoothed round trip time */
+    uint16_t rtt_var;       /* smoothed round trip time deviation */
+    uint16_t rtt_max;       /* longest round trip time measured */
+    uint8_t loss;           /* percent of the last 16 pings lost */
+    uint16_t samples;       /* samples taken */
+    uint16_t paced;         /* sends delayed because the link was degraded */
+    bool degraded;          /* a limit of setQualityLimits is exceeded */
+};
+
+/**
+ * Sleep modes used by the uplink scheduler between cycles. 
+ */
+enum ESP8266SleepMode {
+    ESP8266_SLEEP_NONE = 0,     /* always awake */
+    ESP8266_SLEEP_MODEM,        /* AT+SLEEP=2: radio off between beacons, stays joined */
+    ESP8266_SLEEP_LIGHT,        /* AT+SLEEP=1: woken by the wake pin, set by AT+WAKEUPGPIO */
+    ESP8266_SLEEP_DEEP          /* AT+GSLP: off until reset by the wake pin or GPIO16 */
+};
+
+/**
+ * Statistics of the uplink scheduler, times in ms. 
+ */
+struct ESP8266UplinkStats {
+    uint32_t cycles;            /* wake-send-sleep cycles run */
+    uint32_t failures;          /* cycles which could not send the batch */
+    uint32_t records;           /* records sent */
+    uint32_t bytes;             /* payload bytes sent */
+    uint32_t dropped;           /* records rejected because the batch was full */
+    uint32_t last_radio_on;     /* radio-on time of the last cycle */
+    uint32_t total_radio_on;    /* radio-on time of all cycles */
+};
+
+/**
+ * Counters of send coalescing. 
+ *
+ * writes / flushes is the coalescing ratio: how many send calls shared one AT+CIPSEND. 
+ */
+struct ESP8266CoalesceStats {
+    uint32_t writes;    /* send calls accepted into the buffer */
+    uint32_t flushes;   /* AT+CIPSEND issued for buffered data */
+    uint32_t bytes;     /* payload bytes flushed */
+    uint32_t failures;  /* flushes which did not get "SEND OK", their data is kept and sent again */
+    uint32_t dropped;   /* pending bytes given up by releaseTCP or disableCoalescing after a failed flush */
+};
+
+/**
+ * Counters of the UART link to ESP8266. 
+ */
+struct ESP8266UartStats {
+    uint32_t rx_overruns;   /* times the UART RX buffer was found full(bytes probably lost) */
+    uint32_t rts_pauses;    /* times RTS was raised to stop the ESP8266 */
+    uint32_t cts_waits;     /* bytes whose sending waited for CTS */
+    uint32_t cts_timeouts;  /* bytes sent anyway after CTS stayed high too long */
+    uint16_t rx_high_water; /* most bytes ever held by the library RX buffer */
+    uint32_t rx_lost;       /* bytes dropped because the library RX buffer was full */
+};
+
+/* Number of rates beginBulk tries: 115200, 57600, 38400 and 19200 */
+#define ESP8266_BULK_RATES      4
+
+/**
+ * Record of the bulk transfers at one baud rate, times in ms. 
+ */
+struct ESP8266RateStats {
+    uint32_t baud;
+    uint16_t attempts;      /* beginBulk switches to this rate */
+    uint16_t failures;      /* failed switches or echo probes, and bulk transfers ended with errors */
+    uint32_t bytes;         /* bytes sent and received between beginBulk and endBulk */
+    uint32_t time;          /* time between beginBulk and endBulk */
+};
+
+/**
+ * Takes the body of a download, one buffer at a time. 
+ *
+ * @param data - the next bytes of the body. 
+ * @param len - the length of data. 
+ * @param offset - the position of data in the body. 
+ * @param context - the pointer given to download. 
+ * @retval true - stored, go on. 
+ * @retval false - stop the download. 
+ */
+typedef bool (*ESP8266DownloadSink)(const uint8_t *data, uint16_t len, uint32_t offset, void *context);
+
+/**
+ * Progress and counters of a download, times in ms. 
+ *
+ * offset, total and crc are all a later download needs to resume, keep them(e.g. in EEPROM) 
+ * to resume after a reset too. 
+ */
+struct ESP8266Download {
+    uint32_t offset;        /* body bytes taken by the sink, the next request starts here */
+    uint32_t total;         /* length of the whole body, 0 while unknown */
+    uint32_t crc;           /* CRC-32(as zlib) of the first offset bytes */
+    uint16_t status;        /* HTTP status of the last response */
+    uint8_t connections;    /* connections opened by the last download call */
+    uint32_t frames;        /* +IPD frames read */
+    uint32_t swaps;         /* buffers handed to the sink */
+    uint32_t stalls;        /* swaps in the middle of a frame because both buffers were full */
+    uint32_t overruns;      /* connections given up because the UART RX buffer overflowed */
+    uint32_t sink_time;     /* time spent in the sink */
+};
 
 /**
  * Provide an easy-to-use way to manipulate ESP8266. 
@@ -71,6 +417,23 @@ class ESP8266 {
      */
     bool init(const String &ssid, const String &pwd, uint32_t baudRateSet = 9600);
     
+    /** 
+     * Establish a connection with network, skipping setup steps the module already satisfies. 
+     *
+     * The module is first asked at baudRateSet; the operation mode, the joined AP and its IP, 
+     * and the MUX mode are queried, and only the steps not satisfied yet are run. Nothing is 
+     * printed to Serial. The time of every step is kept for getBootTiming. 
+     * 
+     * @retval true - successful.
+     * @retval false - Unsuccessful.
+     */
+    bool fastInit(const String &ssid, const String &pwd, uint32_t baudRateSet = 9600);
+
+    /**
+     * Get the startup timing of the last fastInit. 
+     */
+    ESP8266BootTiming getBootTiming(void);
+
     /** 
      * Detect ESP8266 baudrate and reset it to baudRateSet
      * 
@@ -92,7 +455,9 @@ class ESP8266 {
     /**
      * Restart ESP8266 by "AT+RST". 
      *
-     * This method will take 3 seconds or more. 
+     * This method returns as soon as the module prints its "ready" banner(usually well 
+     * under a second), or answers the "AT" sent every 100 ms meanwhile for firmware 
+     * without the banner, within 5 seconds. 
      *
      * @retval true - success.
      * @retval false - failure.
@@ -105,9 +470,46 @@ class ESP8266 {
      * @return the string of version. 
      */
     String getVersion(void);
+
+    /**
+     * Detect which of the optional AT commands the firmware supports. 
+     *
+     * "AT+GMR" and one query per optional command the library uses are sent. The library 
+     * then uses the bits to pick its commands, 
+     * without trying and failing at run time. init, fastInit and tryInit probe once by 
+     * themselves unless setCapabilities restored the bits. 
+     *
+     * @return the ESP8266_CAP_* bits, ESP8266_CAP_PROBED included if the module answered. 
+     */
+    uint8_t probeCapabilities(void);
+
+    /**
+     * Get the ESP8266_CAP_* bits. 
+     *
+     * Until they are probed(ESP8266_CAP_PROBED not set) every command is assumed to be 
+     * supported, and a bit is cleared when the firmware answers ERROR to its command. 
+     */
+    uint8_t getCapabilities(void);
+
+    /**
+     * Restore capabilities saved from getCapabilities, e.g. in EEPROM, to skip the probe. 
+     *
+     * @param caps - the ESP8266_CAP_* bits. Save them again after flashing other firmware. 
+     */
+    void setCapabilities(uint8_t caps);
+
+    /**
+     * Whether the firmware supports a command. 
+     *
+     * @param cap - one of the ESP8266_CAP_* bits. 
+     */
+    bool hasCapability(uint8_t cap);
     
     /**
      * Set operation mode to staion. 
+     *
+     * "AT+CWMODE_CUR" is used when the firmware supports it, which needs no restart. 
+     * Older firmware falls back to "AT+CWMODE" and a restart. 
      * 
      * @retval true - success.
      * @retval false - failure.
@@ -149,6 +551,48 @@ class ESP8266 {
      * @note This method will take a couple of seconds. 
      */
     bool joinAP(String ssid, String pwd);
+
+    /**
+     * Find the APs with an SSID, strongest first. 
+     *
+     * Only the SSID is scanned for("AT+CWLAP=<ssid>"), and "AT+CWLAPOPT" leaves the SSID 
+     * out of the answer where the firmware supports it. The default fields are set back 
+     * after the scan, for getAPList. 
+     *
+     * @param ssid - the SSID to look for. 
+     * @param list - where to put the APs found. 
+     * @param size - the most APs to keep, the weakest ones are left out. 
+     * @return the number of APs put in list. 
+     */
+    uint8_t findAP(const String &ssid, ESP8266AP *list, uint8_t size);
+
+    /**
+     * Join in AP, directly by the BSSID remembered from the last join. 
+     *
+     * If the remembered AP fails, the strongest AP of a targeted scan is tried, and a plain 
+     * joinAP only when that fails too. The BSSID and channel joined are remembered. 
+     *
+     * @param ssid - SSID of AP to join in. 
+     * @param pwd - Password of AP to join in. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool joinAPFast(const String &ssid, const String &pwd);
+
+    /**
+     * Get the AP joinAPFast remembers. 
+     */
+    ESP8266FastJoin getFastJoin(void);
+
+    /**
+     * Restore an AP saved from getFastJoin. 
+     */
+    void setFastJoin(const ESP8266FastJoin &record);
+
+    /**
+     * Get the statistics of joinAPFast. 
+     */
+    ESP8266JoinStats getJoinStats(void);
     
     /**
      * Leave AP joined before. 
@@ -191,6 +635,63 @@ class ESP8266 {
      * @return the IP list. 
      */
     String getLocalIP(void);
+
+    /**
+     * Get the MAC address of the station. 
+     *
+     * @return the MAC, "" on failure. 
+     */
+    String getLocalMAC(void);
+
+    /**
+     * Use fixed addresses instead of DHCP. 
+     *
+     * The addresses are kept and set by init, fastInit and tryInit after the operation mode 
+     * and before joining the AP("AT+CIPSTA_CUR", "AT+CIPAP_CUR"), so the station needs no 
+     * DHCP exchange after the join. Call applyStaticIP to set them at another time. 
+     *
+     * @param station - the station addressing, NULL for DHCP. 
+     * @param softap - the softAP addressing, NULL to keep the default 192.168.4.1. 
+     * @note Setting a station address stops its DHCP client. To go back after applyStaticIP, 
+     *  call setStaticIP(NULL) and setDHCP(ESP8266_DHCP_STATION, true). 
+     */
+    void setStaticIP(const ESP8266IPConfig *station, const ESP8266IPConfig *softap = NULL);
+
+    /**
+     * Set the addresses given to setStaticIP now. 
+     *
+     * @retval true - success, or no fixed addresses are given.
+     * @retval false - failure.
+     */
+    bool applyStaticIP(void);
+
+    /**
+     * Enable or disable DHCP("AT+CWDHCP_CUR"). 
+     *
+     * @param mode - ESP8266_DHCP_SOFTAP(the server), ESP8266_DHCP_STATION(the client) or ESP8266_DHCP_BOTH. 
+     * @param enable - true to enable, false to disable. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool setDHCP(uint8_t mode, bool enable);
+
+    /**
+     * Get the addressing of the station, static or from DHCP. 
+     *
+     * @param config - where to put it, 0.0.0.0 for what the firmware does not report. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool getStationIP(ESP8266IPConfig *config);
+
+    /**
+     * Get the addressing of the softAP. 
+     *
+     * @param config - where to put it, 0.0.0.0 for what the firmware does not report. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool getSoftAPIP(ESP8266IPConfig *config);
     
     /**
      * Enable IP MUX(multiple connection mode). 
@@ -290,6 +791,45 @@ class ESP8266 {
      */
     bool unregisterUDP(uint8_t mux_id);
 
+    /**
+     * Register UDP port number in single mode, bound to a local port.
+     *
+     * With mode 2 the remote peer may be changed on every packet with sendTo,
+     * and the source of each incoming datagram is reported(AT+CIPDINFO=1).
+     *
+     * @param addr - the IP or domain name of the default remote host.
+     * @param port - the port number of the default remote host.
+     * @param local_port - the local port number to bind.
+     * @param mode - 0 - fixed peer, 1 - peer changes once, 2 - peer may change at any time(default: 2).
+     * @retval true - success.
+     * @retval false - failure.
+     * @see bool sendTo(const uint8_t *buffer, uint32_t len, String addr, uint32_t port);
+     * @see uint32_t recvFrom(uint8_t *buffer, uint32_t buffer_size, String &addr, uint32_t *port, uint32_t timeout);
+     */
+    bool registerUDP(String addr, uint32_t port, uint32_t local_port, uint8_t mode = 2);
+
+    /**
+     * Register UDP port number in multiple mode, bound to a local port.
+     *
+     * @param mux_id - the identifier of this UDP(available value: 0 - 4).
+     * @param addr - the IP or domain name of the default remote host.
+     * @param port - the port number of the default remote host.
+     * @param local_port - the local port number to bind.
+     * @param mode - 0 - fixed peer, 1 - peer changes once, 2 - peer may change at any time(default: 2).
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool registerUDP(uint8_t mux_id, String addr, uint32_t port, uint32_t local_port, uint8_t mode = 2);
+
+    /**
+     * Report the source IP and port of incoming data("+IPD,<len>,<ip>,<port>:").
+     *
+     * @param enable - true to report the remote address, false to hide it.
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool setRemoteInfo(bool enable);
+
 
     /**
      * Set the timeout of TCP Server. 
@@ -365,6 +905,99 @@ class ESP8266 {
      * @retval false - failure.
      */
     bool send(uint8_t mux_id, const uint8_t *buffer, uint32_t len);
+
+    /**
+     * Send data produced on the fly based on TCP or UDP builded already in single mode. 
+     *
+     * The data goes to the UART as the producer writes it, so reports larger than RAM can be sent. 
+     * More than ESP8266_MAX_CIPSEND bytes are sent by several AT+CIPSEND over TCP; over UDP 
+     * that would split the datagram, so it is refused. 
+     *
+     * @param len - the total length of data to send(over UDP at most ESP8266_MAX_CIPSEND). 
+     * @param producer - called for the data, a few bytes at a time. 
+     * @param context - passed to producer. 
+     * @retval true - success.
+     * @retval false - failure, more than ESP8266_MAX_CIPSEND bytes over UDP, or the producer ran 
+     *  dry before len bytes(the rest is sent as zeros to keep the ESP8266 in step). 
+     */
+    bool send(uint32_t len, ESP8266SendProducer producer, void *context = NULL);
+
+    /**
+     * Send data produced on the fly based on one of TCP or UDP builded already in multiple mode. 
+     *
+     * @param mux_id - the identifier of this TCP(available value: 0 - 4). 
+     * @see bool send(uint32_t len, ESP8266SendProducer producer, void *context);
+     */
+    bool send(uint8_t mux_id, uint32_t len, ESP8266SendProducer producer, void *context = NULL);
+
+    /**
+     * Send data stored in flash(PROGMEM) based on TCP or UDP builded already in single mode. 
+     *
+     * @param buffer - the data in flash. 
+     * @param len - the length of data to send. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool sendP(const uint8_t *buffer, uint32_t len);
+
+    /**
+     * Send data stored in flash(PROGMEM) based on one of TCP or UDP builded already in multiple mode. 
+     */
+    bool sendP(uint8_t mux_id, const uint8_t *buffer, uint32_t len);
+
+    /**
+     * Send several pieces of data as one AT+CIPSEND of their summed length in single mode. 
+     *
+     * The pieces are written to the UART from where they are, e.g. a header built in RAM and 
+     * a body in flash, without joining them in one buffer and without one round trip each. 
+     *
+     * @param segments - the pieces, in order. 
+     * @param count - the number of segments. 
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool send(const ESP8266Segment *segments, uint8_t count);
+
+    /**
+     * Send several pieces of data as one AT+CIPSEND in multiple mode. 
+     *
+     * @param mux_id - the identifier of this TCP(available value: 0 - 4). 
+     * @see bool send(const ESP8266Segment *segments, uint8_t count);
+     */
+    bool send(uint8_t mux_id, const ESP8266Segment *segments, uint8_t count);
+
+    /**
+     * Start sending data without waiting for the ESP8266. 
+     *
+     * AT+CIPSEND is written at once, the rest is done by sendPoll: the payload is written when 
+     * ">" arrives and the send completes with "SEND OK". Several modules can so be driven at 
+     * the same time(see ESP8266Scheduler). buffer must stay unchanged until the send completes. 
+     *
+     * @param buffer - the data to send. 
+     * @param len - the length of data(at most ESP8266_MAX_CIPSEND). 
+     * @param mux_id - the identifier of the TCP in multiple mode, -1 in single mode. 
+     * @retval true - started.
+     * @retval false - another send is in progress, or len is out of range.
+     * @note With SoftwareSerial this instance becomes the listening one. 
+     */
+    bool sendBegin(const uint8_t *buffer, uint32_t len, int8_t mux_id = -1);
+
+    /**
+     * Advance the send started by sendBegin without blocking. 
+     *
+     * @return ESP8266_PENDING while in progress, then ESP8266_SUCCESS or ESP8266_FAILURE once. 
+     */
+    int8_t sendPoll(void);
+
+    /**
+     * Whether a send started by sendBegin is in progress. 
+     */
+    bool sending(void);
+
+    /**
+     * Send a flash string, e.g. send(F("GET / HTTP/1.1\r\n\r\n")), in single mode. 
+     */
+    bool send(const __FlashStringHelper *str);
     
     /**
      * Receive data from TCP or UDP builded already in single mode. 
@@ -401,6 +1034,496 @@ class ESP8266 {
      */
     uint32_t recv(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t buffer_size, uint32_t timeout = 1000);
 
+    /**
+     * Pull data of TCP or UDP builded already in single mode in pieces, for a stream parser. 
+     *
+     * Waits up to timeout for the first piece, then takes at most 31 more which are already 
+     * there, and hands each to sink. 
+     *
+     * @param buffer - the buffer for one piece. 
+     * @param size - the length of the buffer. 
+     * @param sink - called with every piece. 
+     * @param context - passed to sink. 
+     * @param timeout - the time waiting for the first piece. 
+     * @return the length of data pulled. 
+     * @note Use passive receive mode(see setPassiveRecv): in active mode the rest of a +IPD 
+     *  frame longer than the buffer is lost. 
+     */
+    uint32_t recvPieces(uint8_t *buffer, uint16_t size, ESP8266RecvSink sink, void *context, uint32_t timeout);
+
+    /**
+     * Send one datagram to the given peer over the UDP registered in single mode.
+     *
+     * @param buffer - the buffer of data to send.
+     * @param len - the length of data to send.
+     * @param addr - the IP of the remote host.
+     * @param port - the port number of the remote host.
+     * @retval true - success.
+     * @retval false - failure.
+     * @note The UDP should be registered with mode 2.
+     */
+    bool sendTo(const uint8_t *buffer, uint32_t len, String addr, uint32_t port);
+
+    /**
+     * Send one datagram to the given peer over one of UDP registered in multiple mode.
+     *
+     * @param mux_id - the identifier of this UDP(available value: 0 - 4).
+     * @param buffer - the buffer of data to send.
+     * @param len - the length of data to send.
+     * @param addr - the IP of the remote host.
+     * @param port - the port number of the remote host.
+     * @retval true - success.
+     * @retval false - failure.
+     */
+    bool sendTo(uint8_t mux_id, const uint8_t *buffer, uint32_t len, String addr, uint32_t port);
+
+    /**
+     * Receive one datagram and its source from the UDP registered in single mode.
+     *
+     * Packet boundaries are kept: if the datagram is longer than buffer_size, the
+     * rest of it is dropped, but datagrams queued behind it are not.
+     *
+     * @param buffer - the buffer for storing data.
+     * @param buffer_size - the length of the buffer.
+     * @param addr - the IP of the sender.
+     * @param port - the port number of the sender.
+     * @param timeout - the time waiting data.
+     * @return the length of data received actually.
+     */
+    uint32_t recvFrom(uint8_t *buffer, uint32_t buffer_size, String &addr, uint32_t *port, uint32_t timeout = 1000);
+
+    /**
+     * Receive one datagram and its source from all of UDP registered in multiple mode.
+     *
+     * @param coming_mux_id - the identifier of UDP.
+     * @param buffer - the buffer for storing data.
+     * @param buffer_size - the length of the buffer.
+     * @param addr - the IP of the sender.
+     * @param port - the port number of the sender.
+     * @param timeout - the time waiting data.
+     * @return the length of data received actually.
+     */
+    uint32_t recvFrom(uint8_t *coming_mux_id, uint8_t *buffer, uint32_t buffer_size, String &addr, uint32_t *port, uint32_t timeout = 1000);
+
+    /**
+     * Download a file over HTTP into a sink, resuming after dropped connections. 
+     *
+     * The body is read from the +IPD frames into the two halves of buffer in turn. A full half 
+     * is handed to the sink once the frame is read and the UART is quiet, while the other half 
+     * takes the bytes still coming; only when both are full is the sink called in the middle of 
+     * a frame(a stall). A CRC-32 of what the sink took is kept in state. 
+     *
+     * When the connection drops before the end, the download goes on from state->offset with 
+     * "Range: bytes=<offset>-" on a new connection; a state kept from an earlier call resumes 
+     * the same way. If the server ignores the range, the bytes before offset are skipped. 
+     * An overflow of the UART RX buffer(a sink too slow for the baud rate) is handled like a 
+     * drop, so the sink never gets bytes after a gap. 
+     *
+     * @param host - the IP or domain name of the server. 
+     * @param port - the port number of the server. 
+     * @param path - the path of the file, e.g. "/firmware.bin". 
+     * @param buffer - the two buffers, owned by the caller. 
+     * @param size - the size of buffer, size / 2 bytes per half. 
+     * @param sink - takes the body. 
+     * @param context - passed to sink. 
+     * @param state - the progress, all zero to start from the first byte. 
+     * @param retries - new connections without progress before giving up(default: 3). 
+     * @param timeout - the time without data after which the connection counts as dropped. 
+     * @retval true - the whole body was taken by the sink. 
+     * @retval false - failure, state tells how far it went. 
+     * @note Single connection mode. Passive receive mode is turned off during the download. 
+     * Without Content-Length the body ends when the server closes the connection. 
+     */
+    bool download(String host, uint32_t port, const char *path, uint8_t *buffer, uint16_t size,
+                  ESP8266DownloadSink sink, void *context, ESP8266Download *state,
+                  uint8_t retries = 3, uint32_t timeout = 5000);
+
+
+    /**
+     * Enable or disable passive receive mode(AT+CIPRECVMODE). 
+     *
+     * In passive mode the module keeps incoming TCP data in its own buffer and only notifies 
+     * "+IPD,<id>,<len>". The recv methods then pull at most buffer_size bytes per call with 
+     * AT+CIPRECVDATA, so the UART RX buffer can not be overrun by a large response. 
+     *
+     * @param enable - true for passive mode, false for active mode(default of the firmware).
+     * @retval true - success.
+     * @retval false - failure, or the firmware has no ESP8266_CAP_CIPRECVMODE.
+     * @note Passive mode applies to TCP only. Data not pulled yet stays in the module. 
+     */
+    bool setPassiveRecv(bool enable);
+
+#ifndef ESP8266_USE_SOFTWARE_SERIAL
+    /**
+     * Enable RTS/CTS hardware flow control(HardwareSerial only). 
+     *
+     * The ESP8266 is set by "AT+UART_CUR=<baud>,8,1,0,<flow>" and the UART is restarted at baud. 
+     * The library raises rts_pin(wired to ESP8266 CTS, GPIO13) while the UART RX buffer holds 
+     * ESP8266_RTS_HIGH_WATER bytes or more, and waits for cts_pin(wired to ESP8266 RTS, GPIO15) 
+     * to be low before writing payload bytes. 
+     *
+     * @param baud - the baud rate to use with flow control. 
+     * @param rts_pin - the output pin to ESP8266 CTS(ESP8266_NO_PIN - not used). 
+     * @param cts_pin - the input pin from ESP8266 RTS(ESP8266_NO_PIN - not used). 
+     * @retval true - success.
+     * @retval false - failure, or the firmware has no ESP8266_CAP_UART_CUR.
+     * @note RTS is only updated while the library reads the UART. 
+     */
+    bool setFlowControl(uint32_t baud, uint8_t rts_pin, uint8_t cts_pin);
+#endif
+
+    /**
+     * Give the library its own RX ring buffer. 
+     *
+     * Bytes are moved from the UART into it on every poll of the receive and wait loops, and 
+     * while payload is written, so the small UART RX buffer(64 bytes for SoftwareSerial) does 
+     * not overflow during slow processing. No change to the Arduino core is needed. 
+     *
+     * @param buffer - the storage of the ring, owned by the caller(NULL - disable). 
+     * @param size - the size of buffer. 
+     * @note Bytes still held when the ring is disabled are dropped. 
+     */
+    void setRxBuffer(uint8_t *buffer, uint16_t size);
+
+    /**
+     * Get the counters of the UART link(overruns, flow control and the library RX buffer). 
+     */
+    ESP8266UartStats getUartStats(void);
+
+    /**
+     * Switch both sides to a faster baud rate for a bulk transfer. 
+     *
+     * The fastest rate up to max_baud is set by "AT+UART_CUR" and checked by an echo probe: 
+     * "AT+GMR" must be answered exactly as at the current rate. A rate which fails is left for 
+     * the next slower one, the current rate stays when none works. Rates failing more than half 
+     * of their attempts(at least 3 failures) are not tried any more. 
+     *
+     * @param max_baud - the fastest rate to try(default: 115200). 
+     * @return the rate in use, the current one if no faster rate works. 
+     * @note Call endBulk when the transfer is over. 
+     */
+    uint32_t beginBulk(uint32_t max_baud = 115200);
+
+    /**
+     * Go back to the rate before beginBulk, recording the throughput of the bulk rate. 
+     *
+     * @param ok - false if the transfer failed, which counts against the rate like RX overruns do. 
+     * @retval true - the module answers at the rate before beginBulk.
+     * @retval false - it could not be found again.
+     */
+    bool endBulk(bool ok = true);
+
+    /**
+     * Get the record of a bulk rate. 
+     *
+     * @param index - 0 for the fastest rate, up to ESP8266_BULK_RATES - 1. 
+     * @note Throughput is bytes * 1000 / time bytes per second. 
+     */
+    ESP8266RateStats getRateStats(uint8_t index);
+
+    /**
+     * Record every byte on the UART with its direction and time into a ring. 
+     *
+     * Each byte takes one 4 byte entry(ESP8266_TRACE_*), so a 1 KB buffer holds the last 256 
+     * bytes of traffic. RX bytes are stamped when the library takes them from the UART. 
+     * Get the trace with dumpTrace and study it with extras/trace_replay. 
+     *
+     * @param buffer - the storage of the ring, owned by the caller(NULL - stop recording). 
+     * @param size - the size of buffer. 
+     */
+    void setTrace(uint8_t *buffer, uint16_t size);
+
+    /**
+     * Write the recorded trace, oldest entry first, in the file format of extras/trace_replay. 
+     *
+     * @param out - where to write, e.g. Serial or a file on an SD card. 
+     * @return the number of entries written. 
+     */
+    uint16_t dumpTrace(Print &out);
+
+    /**
+     * Set the range of the adaptive timeout of a command class. 
+     *
+     * @param cmd_class - one of ESP8266CmdClass. 
+     * @param floor - the shortest timeout by ms. 
+     * @param ceiling - the longest timeout by ms. 
+     * @retval true - success.
+     * @retval false - invalid class or range.
+     */
+    bool setTimeoutBounds(uint8_t cmd_class, uint16_t floor, uint16_t ceiling);
+
+    /**
+     * Get the current estimate of a command class. 
+     *
+     * @param cmd_class - one of ESP8266CmdClass. 
+     */
+    ESP8266Timeout getTimeout(uint8_t cmd_class);
+
+    /**
+     * Configure the retry policy of an operation. 
+     *
+     * @param op - one of ESP8266PolicyOp. 
+     * @param max_failures - consecutive failures which open the circuit. 
+     * @param base_delay - the backoff after the first failure by ms. 
+     * @param max_delay - the longest backoff by ms. 
+     * @param open_time - how long an open circuit rejects attempts by ms. 
+     * @retval true - success.
+     * @retval false - invalid operation.
+     */
+    bool setPolicy(uint8_t op, uint8_t max_failures, uint16_t base_delay, uint16_t max_delay, uint32_t open_time);
+
+    /**
+     * Get the policy, state and statistics of an operation. 
+     *
+     * @param op - one of ESP8266PolicyOp. 
+     */
+    ESP8266Policy getPolicy(uint8_t op);
+
+    /**
+     * Check whether an operation may be attempted now. Never blocks. 
+     *
+     * @param op - one of ESP8266PolicyOp. 
+     * @return ESP8266_SUCCESS if allowed, ESP8266_BACKOFF or ESP8266_BREAKER_OPEN if not. 
+     */
+    int8_t policyCheck(uint8_t op);
+
+    /**
+     * Report the result of an attempt allowed by policyCheck. 
+     *
+     * @param op - one of ESP8266PolicyOp. 
+     * @param success - the result of the attempt. 
+     * @return ESP8266_SUCCESS or ESP8266_FAILURE. 
+     */
+    int8_t policyReport(uint8_t op, bool success);
+
+    /**
+     * Step by step version of init. 
+     *
+     * Call it from loop() until it returns ESP8266_SUCCESS. Every call runs at most one 
+     * pending setup step(baud, operation mode, join, single mode), and returns at once 
+     * while the step is backing off. A step blocks like its command: the baud detection and 
+     * the join can take seconds. 
+     *
+     * When the module is reset(its "ready" banner is seen, or restart is called) the steps 
+     * start over, so after a brown-out the next call sets the module up again. 
+     *
+     * @return one of ESP8266Status. 
+     */
+    int8_t tryInit(const String &ssid, const String &pwd, uint32_t baudRateSet = 9600);
+
+    /**
+     * Make tryInit run all its steps again, e.g. after the module was reset by its pin. 
+     */
+    void resetInit(void);
+
+    /**
+     * Join in AP under the ESP8266_OP_JOIN policy. 
+     *
+     * @return one of ESP8266Status. 
+     */
+    int8_t tryJoinAP(String ssid, String pwd);
+
+    /**
+     * Create TCP connection in single mode under the ESP8266_OP_CONNECT policy. 
+     *
+     * @return one of ESP8266Status. 
+     */
+    int8_t tryCreateTCP(String addr, uint32_t port);
+
+    /**
+     * Create TCP connection in multiple mode under the ESP8266_OP_CONNECT policy. 
+     *
+     * @return one of ESP8266Status. 
+     */
+    int8_t tryCreateTCP(uint8_t mux_id, String addr, uint32_t port);
+
+    /**
+     * Coalesce small sends in single mode into one AT+CIPSEND(Nagle-style). 
+     *
+     * Data passed to send(buffer, len) is appended to the given buffer and sent when 
+     * threshold bytes are pending, when max_delay ms passed since the first pending byte 
+     * (checked by send and poll), or on flush. Sends larger than the buffer go out directly. 
+     * Use it with TCP: UDP packet boundaries are not kept. 
+     *
+     * @param buffer - the storage for pending data, owned by the caller. 
+     * @param size - the size of buffer. 
+     * @param threshold - pending bytes which trigger a flush(0 - use size). 
+     * @param max_delay - the longest time data may wait in the buffer by ms(default: 50). 
+     * @retval true - success.
+     * @retval false - failure.
+     * @note send returns true once data is buffered; errors are reported by the flush. 
+     */
+    bool setCoalescing(uint8_t *buffer, uint16_t size, uint16_t threshold = 0, uint32_t max_delay = 50);
+
+    /**
+     * Flush pending data and stop coalescing. 
+     *
+     * @retval true - success.
+     * @retval false - failure of the last flush, the pending data is dropped(see getCoalesceStats).
+     */
+    bool disableCoalescing(void);
+
+    /**
+     * Send the data pending in the coalescing buffer now. 
+     *
+     * @retval true - success or nothing to send.
+     * @retval false - failure, the data stays pending and is sent by the next flush.
+     */
+    bool flush(void);
+
+    /**
+     * Run background work of the library. Call it from loop(). 
+     *
+     * Drains the UART into the library RX buffer, flushes coalesced data whose deadline 
+     * has passed, runs the uplink scheduler and the link supervisor. 
+     */
+    void poll(void);
+
+    /**
+     * Supervise the Wi-Fi link from poll. 
+     *
+     * "WIFI DISCONNECT" and "WIFI GOT IP" seen on the UART update the link state at once; 
+     * while up, the link is also probed by AT+CIPSTATUS every probe_interval. While down, 
+     * poll rejoins the AP under the ESP8266_OP_JOIN retry policy. It sends AT+CWJAP and returns: 
+     * the answer is read by the following poll calls. Any other command of the library called 
+     * meanwhile waits for the answer, up to the join timeout, as the module takes none while joining. 
+     *
+     * @param ssid - SSID of AP to rejoin. 
+     * @param pwd - Password of AP to rejoin. 
+     * @param probe_interval - the time between AT+CIPSTATUS probes by ms(default: 30000). 
+     * @note A probe empties UART RX first: call poll when no data is expected, or use passive receive mode. 
+     */
+    void startSupervisor(const String &ssid, const String &pwd, uint32_t probe_interval = 30000);
+
+    /**
+     * Stop supervising the link, e.g. before leaveAP. 
+     */
+    void stopSupervisor(void);
+
+    /**
+     * Measure the link quality from poll. 
+     *
+     * Every interval, poll asks "AT+CWJAP?" for the RSSI and then "AT+PING=<host>" for the 
+     * round trip time. It never waits for the answers: they are read by the following poll calls. 
+     * Any other command of the library first reads the answer in progress, up to 5 s for a ping, 
+     * and skips the ping if it was not sent yet. A weak RSSI with a good round trip time points 
+     * at the radio, a good RSSI with a slow or lost ping at the AP or the backend. 
+     *
+     * @param host - the IP or domain name to ping, "" to measure the RSSI only. 
+     * @param interval - the time between samples by ms(default: 10000). 
+     * @note Samples are taken in passive receive mode only(see setPassiveRecv): in active mode 
+     *  the data of the connections would come in between the answers and be lost. 
+     */
+    void startMonitor(const String &host, uint32_t interval = 10000);
+
+    /**
+     * Stop measuring the link quality. 
+     */
+    void stopMonitor(void);
+
+    /**
+     * Set when the link counts as degraded. 
+     *
+     * @param min_rssi - the smoothed RSSI below which it is degraded(default: -80 dBm). 
+     * @param max_rtt - the smoothed round trip time above which it is degraded(default: 1000 ms). 
+     * @param max_loss - the ping loss above which it is degraded(default: 25 percent). 
+     */
+    void setQualityLimits(int8_t min_rssi, uint16_t max_rtt, uint8_t max_loss);
+
+    /**
+     * Slow down sending while the link is degraded. 
+     *
+     * @param gap - the least time between two AT+CIPSEND of the blocking send methods by ms, 0 - no pacing. 
+     * @param batch - coalesced data is held batch times longer than max_delay of setCoalescing. 
+     */
+    void setDegradedPacing(uint16_t gap, uint8_t batch = 1);
+
+    /**
+     * Get the link quality measured by the monitor. 
+     */
+    ESP8266LinkQuality getLinkQuality(void);
+
+    /**
+     * Configure the duty-cycled uplink scheduler. 
+     *
+     * Records queued by queueUplink are kept in buffer. When the oldest record waited interval ms, 
+     * or the buffer is 3/4 full, poll wakes the module, opens one TCP connection to host, sends 
+     * the whole batch by one AT+CIPSEND, closes it and puts the module back to sleep_mode. 
+     * A longer interval means larger batches and less radio-on time, at the cost of latency. 
+     *
+     * @param buffer - the storage for queued records, owned by the caller. 
+     * @param size - the size of buffer(at most 2048, the limit of AT+CIPSEND). 
+     * @param host - the IP or domain name of the target host. 
+     * @param port - the port number of the target host. 
+     * @param interval - the longest time a record waits by ms. 
+     * @param sleep_mode - one of ESP8266SleepMode(default: ESP8266_SLEEP_MODEM). 
+     * @param wake_pin - the output pulsed low to wake the module(ESP8266_NO_PIN - none). 
+     * @param wake_gpio - the GPIO of the module wake_pin is wired to, set by AT+WAKEUPGPIO 
+     *  (ESP8266_NO_PIN - none). Light sleep needs both wake_pin and wake_gpio. 
+     * @retval true - success.
+     * @retval false - failure.
+     * @note Deep sleep resets the module: settings made by _CUR commands, passive receive mode 
+     *  and flow control are lost. The station must be saved to flash to rejoin by itself. 
+     * @note While the module sleeps, poll neither probes the link nor takes link quality samples. 
+     *  After a failed cycle the batch waits a whole interval before the next one. 
+     */
+    bool setUplink(uint8_t *buffer, uint16_t size, const String &host, uint32_t port, uint32_t interval,
+                   uint8_t sleep_mode = ESP8266_SLEEP_MODEM, uint8_t wake_pin = ESP8266_NO_PIN,
+                   uint8_t wake_gpio = ESP8266_NO_PIN);
+
+    /**
+     * Queue one record for the next uplink cycle. Never touches the UART. 
+     *
+     * @param data - the record. 
+     * @param len - the length of the record. 
+     * @retval true - queued.
+     * @retval false - the batch is full(counted as dropped).
+     */
+    bool queueUplink(const uint8_t *data, uint16_t len);
+
+    /**
+     * Run an uplink cycle now if any record is queued. 
+     *
+     * @retval true - success or nothing to send.
+     * @retval false - failure, the batch is kept for the next cycle.
+     */
+    bool flushUplink(void);
+
+    /**
+     * Get the statistics of the uplink scheduler. 
+     */
+    ESP8266UplinkStats getUplinkStats(void);
+
+    /**
+     * Get the state of the Wi-Fi link, one of ESP8266LinkState. 
+     *
+     * Check it before sending to buffer data while the link is down. 
+     */
+    uint8_t getLinkState(void);
+
+    /**
+     * Get the statistics of the link supervisor. 
+     */
+    ESP8266LinkStats getLinkStats(void);
+
+    /**
+     * Get the counters of the module state cache. 
+     *
+     * The operation mode, MUX, TCP server, local IP/MAC and joined AP are remembered once set 
+     * or queried, so repeated setters and getters cost no UART traffic. "WIFI ..." notifications 
+     * drop the AP and addresses, "ready" after a reset, restart and deep sleep drop everything. 
+     */
+    ESP8266CacheStats getCacheStats(void);
+
+    /**
+     * Drop the cached module state, e.g. after sending AT commands around the library. 
+     */
+    void invalidateCache(void);
+
+    /**
+     * Get the counters of send coalescing. 
+     */
+    ESP8266CoalesceStats getCoalesceStats(void);
 
     int recvSingle(uint8_t *buffer, int bufferLen);
     bool sendSingle(const char* url);
@@ -413,6 +1536,74 @@ class ESP8266 {
      * Empty the buffer or UART RX.
      */
     void rx_empty(void);
+
+    /*
+     * Number of bytes waiting in UART RX. Drives RTS and counts overruns. 
+     */
+    int rx_available(void);
+
+    /*
+     * Read one byte from UART RX. 
+     */
+    int rx_read(void);
+
+    /*
+     * Read one payload byte from UART RX, not scanned for notifications like "ready". 
+     */
+    int rx_readPayload(void);
+
+    /*
+     * Read a string through rx_read, up to terminator(-1 - none) or a second of silence. 
+     */
+    String rx_readStringUntil(int terminator);
+
+    /*
+     * Move bytes waiting in the UART into the library RX buffer. 
+     */
+    void rx_pump(void);
+
+    /*
+     * Write one byte to UART TX, honoring CTS. 
+     */
+    size_t tx_write(uint8_t c);
+
+    /*
+     * Append one byte of UART traffic to the trace. 
+     */
+    void traceByte(uint8_t type, uint8_t c);
+
+    /*
+     * Track "WIFI ..." and passive "+IPD," notifications in the bytes read from UART. 
+     */
+    void linkScan(char c);
+
+    /*
+     * Change the link state and account disconnect and reconnect times. 
+     */
+    void linkSet(uint8_t state);
+
+    /*
+     * Wake the module for an uplink cycle and wait until it can send. 
+     */
+    bool uplinkWake(void);
+
+    /*
+     * Put the module back to the sleep mode of the uplink scheduler. 
+     */
+    void uplinkSleep(uint32_t duration);
+    /*
+     * Pull data buffered by the module in passive receive mode. 
+     *
+     * @param mux_id - the link to read, -1 for single mode or any link. 
+     * @param coming_mux_id - in single connection mode, should be NULL and not NULL in multiple. 
+     */
+    uint32_t recvPassive(uint8_t *buffer, uint32_t buffer_size, uint32_t timeout, int8_t mux_id, uint8_t *coming_mux_id);
+
+    /*
+     * Wait for one "+IPD,<id>,<len>" notification of passive mode and record the pending length. 
+     */
+    bool recvPassiveNotify(uint32_t timeout);
+
     /* 
      * Recvive data from uart. Return all received data if target found or timeout. 
      */
@@ -432,6 +1623,25 @@ class ESP8266 {
      * Recvive data from uart and search first target. Return true if target found, false for timeout.
      */
     bool recvFind(String target, uint32_t timeout = 1000);
+
+    /*
+     * Like recvString and recvFind, with the adaptive timeout of cmd_class. 
+     * A response matching any target updates the estimate, a timeout backs it off. 
+     * recvFindTimed stops at "ERROR" and "FAIL" too, which are responses as well; len is 
+     * the payload before "SEND OK", whose time is allowed on top of the estimate. 
+     */
+    String recvStringTimed(uint8_t cmd_class, String target1, String target2, String target3 = "");
+    bool recvFindTimed(String target, uint8_t cmd_class, uint32_t len = 0);
+
+    /*
+     * Update the estimate of cmd_class with a response after elapsed ms. 
+     */
+    void timeoutSample(uint8_t cmd_class, uint32_t elapsed);
+
+    /*
+     * Back off the estimate of cmd_class after a timeout. 
+     */
+    void timeoutExpired(uint8_t cmd_class);
     
     /* 
      * Recvive data from uart and search first target and cut out the substring between begin and end(excluding begin and end self). 
@@ -447,16 +1657,118 @@ class ESP8266 {
      * @param data_len - the length of data actually received(maybe more than buffer_size, the remained data will be abandoned).
      * @param timeout - the duration waitting data comming.
      * @param coming_mux_id - in single connection mode, should be NULL and not NULL in multiple. 
+     * @param remote_ip - the IP of the sender when AT+CIPDINFO=1, NULL if not wanted. 
+     * @param remote_port - the port of the sender when AT+CIPDINFO=1, NULL if not wanted. 
+     *
+     * When remote_ip is given the package is treated as a datagram: only the rest of it 
+     * is skipped, instead of emptying the whole UART RX. 
      */
-    uint32_t recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_len, uint32_t timeout, uint8_t *coming_mux_id);
+    uint32_t recvPkg(uint8_t *buffer, uint32_t buffer_size, uint32_t *data_len, uint32_t timeout, uint8_t *coming_mux_id,
+                     String *remote_ip = NULL, uint32_t *remote_port = NULL);
     
     
     bool eATRST(void);
     bool eATGMR(String &version);
     bool eAT(void);
+    /*
+     * Send a query and tell whether it was answered by OK rather than ERROR. 
+     */
+    bool qATSupported(const char *query);
+    /*
+     * Set the baud rate of both sides by AT+UART_CUR. 
+     */
+    bool bulkSwitch(uint32_t baud);
+    /*
+     * Get back to m_baud after a bulk rate, whatever rate the module is at. 
+     */
+    bool bulkRestore(uint32_t from);
+    /*
+     * One connection of download: request the body from state->offset and read it until 
+     * the end or a drop. Returns DOWNLOAD_*. 
+     */
+    uint8_t downloadRange(const String &host, uint32_t port, const char *path, uint8_t *buffer,
+                          uint16_t half, ESP8266DownloadSink sink, void *context,
+                          ESP8266Download *state, uint32_t timeout);
+    /*
+     * Hand len bytes to the sink and account for them in state. 
+     */
+    bool downloadSink(const uint8_t *data, uint16_t len, ESP8266DownloadSink sink, void *context,
+                      ESP8266Download *state);
+    /*
+     * Take or continue a link quality sample, from poll. 
+     */
+    void monitorPoll(void);
+    /*
+     * Read the answer of a sample or supervisor join in progress before another command. 
+     */
+    void monitorDrain(void);
+    /*
+     * Account the answer to AT+CWJAP= sent by the supervisor. 
+     */
+    void monitorJoined(bool success);
+    /*
+     * Send AT+CWJAP= without waiting for the answer. 
+     */
+    void joinSend(const String &ssid, const String &pwd, const uint8_t *bssid);
+    /*
+     * Update the link state and the caches after a join. 
+     */
+    void joinDone(const String &ssid);
+    /*
+     * Account a finished link quality sample. 
+     */
+    void monitorSample(int8_t rssi, bool pinged, uint16_t rtt);
+    /*
+     * Wait before a send while the link is degraded. 
+     */
+    void pace(void);
+    /*
+     * The time coalesced data is held, longer while the link is degraded. 
+     */
+    uint32_t coalesceDelay(void);
+    /*
+     * Give up the pending coalesced data, counting it as dropped. 
+     */
+    void coalesceDiscard(void);
+    /*
+     * Whether a part of the module state is cached, counting the hit or miss. Pending RX is 
+     * read first, so unsolicited lines can drop the part. 
+     */
+    bool cacheGet(uint8_t part);
+    /*
+     * Drop parts of the cached module state. 
+     */
+    void cacheDrop(uint8_t parts);
+    /*
+     * Read the local IP and MAC into the cache by AT+CIFSR. 
+     */
+    bool cacheAddr(void);
+    /*
+     * Set operation mode, restarting only if the firmware lacks AT+CWMODE_CUR. 
+     */
+    bool setOprMode(uint8_t mode);
+
+    /*
+     * Wait for the "ready" banner printed after boot, or for the answer to "AT" sent 
+     * every READY_POLL_INTERVAL ms. 
+     */
+    bool recvReady(uint32_t timeout);
+
     bool qATCWMODE(uint8_t *mode);
     bool sATCWMODE(uint8_t mode);
-    bool sATCWJAP(String ssid, String pwd);
+    bool sATCWMODECUR(uint8_t mode);
+    bool sATCWJAP(String ssid, String pwd, const uint8_t *bssid = NULL);
+    bool qATCWJAP(String &ssid);
+    bool qATCWJAP(ESP8266AP *ap);
+    bool sATCWLAPOPT(uint8_t sort, uint16_t mask);
+    /*
+     * AT+CIPSTA or AT+CIPAP, iface "STA" or "AP". 
+     */
+    bool sATCIPADDR(const char *iface, const ESP8266IPConfig &config);
+    bool qATCIPADDR(const char *iface, ESP8266IPConfig *config);
+    bool sATCWDHCP(uint8_t mode, uint8_t enable);
+    bool qATCIPSTATUS(uint8_t *status);
+    bool qATCIPMUX(uint8_t *mode);
     bool eATCWLAP(String &list);
     bool eATCWQAP(void);
     bool sATCWSAP(String ssid, String pwd, uint8_t chl, uint8_t ecn);
@@ -465,18 +1777,158 @@ class ESP8266 {
     bool eATCIPSTATUS(String &list);
     bool sATCIPSTARTSingle(String type, String addr, uint32_t port);
     bool sATCIPSTARTMultiple(uint8_t mux_id, String type, String addr, uint32_t port);
+    bool sATCIPSTARTUDPSingle(String addr, uint32_t port, uint32_t local_port, uint8_t mode);
+    bool sATCIPSTARTUDPMultiple(uint8_t mux_id, String addr, uint32_t port, uint32_t local_port, uint8_t mode);
     bool sATCIPSENDSingle(const uint8_t *buffer, uint32_t len);
     bool sATCIPSENDMultiple(uint8_t mux_id, const uint8_t *buffer, uint32_t len);
+    bool sATCIPSENDSingleTo(const uint8_t *buffer, uint32_t len, String addr, uint32_t port);
+    bool sATCIPSENDMultipleTo(uint8_t mux_id, const uint8_t *buffer, uint32_t len, String addr, uint32_t port);
+    bool sATCIPSENDStream(int8_t mux_id, uint32_t len, ESP8266SendProducer producer, void *context);
     bool sATCIPCLOSEMulitple(uint8_t mux_id);
     bool eATCIPCLOSESingle(void);
     bool eATCIFSR(String &list);
     bool sATCIPMUX(uint8_t mode);
     bool sATCIPSERVER(uint8_t mode, uint32_t port = 333);
     bool sATCIPSTO(uint32_t timeout);
+    bool sATCIPDINFO(uint8_t mode);
+    bool sATSLEEP(uint8_t mode);
+    bool sATWAKEUPGPIO(uint8_t enable, uint8_t gpio, uint8_t level);
+    bool sATGSLP(uint32_t time);
+    bool sATCIPRECVMODE(uint8_t mode);
+    bool sATUARTCUR(uint32_t baud, uint8_t flow_control);
+    uint32_t sATCIPRECVDATA(int8_t mux_id, uint8_t *buffer, uint32_t len);
+    bool qATCIPRECVLEN(void);
 
 
       uint8_t m_responseBuffer[MAX_BUFFER_SIZE] = {0};
 
+    uint8_t *m_coalesceBuffer = NULL; /* Pending data of send coalescing, NULL if disabled */
+    uint16_t m_coalesceSize = 0;
+    uint16_t m_coalesceThreshold = 0;
+    uint16_t m_coalesceLen = 0;
+    uint32_t m_coalesceDelay = 0;
+    unsigned long m_coalesceStart = 0; /* millis() of the first pending byte */
+    ESP8266CoalesceStats m_coalesceStats = {0, 0, 0, 0, 0};
+
+    uint8_t m_asyncState = 0; /* The step of the send started by sendBegin, 0 if none */
+    const uint8_t *m_asyncBuffer = NULL;
+    uint32_t m_asyncLen = 0;
+    uint32_t m_asyncPos = 0; /* payload bytes written */
+    unsigned long m_asyncStart = 0; /* millis() the current step started */
+    uint8_t m_asyncMatch = 0; /* chars of the awaited response matched */
+    uint8_t m_asyncError = 0; /* chars of "ERROR" matched */
+    uint8_t m_asyncFail = 0; /* chars of "FAIL" matched */
+
+    bool m_passiveRecv = false;
+    bool m_passiveSync = false; /* a notification was dropped or read by another answer, ask AT+CIPRECVLEN? */
+    uint8_t m_udpLinks = 0; /* bit mux_id set(bit 0 in single mode): the link was started as UDP */
+    uint16_t m_passivePending[5] = {0}; /* Bytes buffered by the module per link(single mode: 0) */
+
+    ESP8266Timeout m_timeouts[ESP8266_CMD_CLASSES] = {
+        /* srtt, rttvar, rto, floor, ceiling, samples, expired */
+        {0, 0, 10000, 200, 10000, 0, 0},    /* ESP8266_CMD_CONNECT */
+        {0, 0, 5000, 250, 5000, 0, 0},      /* ESP8266_CMD_PROMPT */
+        {0, 0, 10000, 500, 10000, 0, 0},    /* ESP8266_CMD_SEND */
+        {0, 0, 15000, 1000, 20000, 0, 0},   /* ESP8266_CMD_JOIN */
+        {0, 0, 5000, 250, 5000, 0, 0},      /* ESP8266_CMD_CLOSE */
+        {0, 0, 15000, 1000, 20000, 0, 0},   /* ESP8266_CMD_JOIN_BSSID */
+    };
+
+    ESP8266Policy m_policies[ESP8266_OP_CLASSES] = {
+        /* max_failures, base_delay, max_delay, open_time, then state */
+        {5, 500, 8000, 60000, ESP8266_CIRCUIT_CLOSED, 0, 0, 0, 0, 0, 0},   /* ESP8266_OP_INIT */
+        {5, 2000, 30000, 120000, ESP8266_CIRCUIT_CLOSED, 0, 0, 0, 0, 0, 0}, /* ESP8266_OP_JOIN */
+        {5, 500, 16000, 60000, ESP8266_CIRCUIT_CLOSED, 0, 0, 0, 0, 0, 0},  /* ESP8266_OP_CONNECT */
+        {5, 500, 16000, 60000, ESP8266_CIRCUIT_CLOSED, 0, 0, 0, 0, 0, 0},  /* ESP8266_OP_USER */
+    };
+    uint8_t m_initPhase = 0; /* the next step of tryInit */
+    uint8_t m_caps = (uint8_t)~ESP8266_CAP_PROBED; /* ESP8266_CAP_* bits, all assumed until probed */
+    ESP8266BootTiming m_bootTiming = {0, 0, 0, 0, 0, 0};
+
+    uint8_t m_linkState = ESP8266_LINK_UNKNOWN;
+    ESP8266LinkStats m_linkStats = {0, 0, 0, 0, 0};
+    uint8_t m_cacheValid = 0; /* ESP8266_CACHE_* parts known */
+    uint8_t m_cacheMode = 0;
+    uint8_t m_cacheMux = 0;
+    uint32_t m_cachePort = 0; /* TCP server port, 0 if stopped */
+    char m_cacheIP[16];
+    char m_cacheMAC[18];
+    char m_cacheSSID[33]; /* "" if not joined */
+    ESP8266CacheStats m_cacheStats = {0, 0, 0};
+    ESP8266FastJoin m_fastJoin = {{0, 0, 0, 0, 0, 0}, 0, 0};
+    ESP8266JoinStats m_joinStats = {0, 0, 0, 0, 0, 0};
+    ESP8266IPConfig m_staticSTA;
+    ESP8266IPConfig m_staticAP;
+    uint8_t m_staticIP = 0; /* 1 - m_staticSTA is set, 2 - m_staticAP is set */
+    unsigned long m_linkDownSince = 0;
+    unsigned long m_linkProbed = 0;
+    char m_linkLine[16]; /* the start of the current UART line */
+    uint8_t m_linkLineLen = 0;
+    bool m_supervise = false;
+    String m_monitorHost;
+    uint32_t m_monitorInterval = 0; /* 0 - the monitor is stopped */
+    unsigned long m_monitorStart = 0; /* millis() the last sample or supervisor join started */
+    uint8_t m_monitorState = 0;
+    char m_monitorLine[8]; /* the start of the current answer line */
+    uint8_t m_monitorLineLen = 0;
+    int32_t m_monitorValue = 0; /* the number in the last field of the line */
+    bool m_monitorNeg = false;
+    int8_t m_monitorRssi = 0;
+    int32_t m_monitorRtt = -1; /* -1 - no round trip time in the answer */
+    bool m_monitorDrain = false; /* another command waits for the sample to end */
+    uint16_t m_lossHistory = 0; /* a bit per ping, 1 - lost, newest in bit 0 */
+    uint8_t m_lossCount = 0; /* pings in m_lossHistory */
+    int8_t m_minRssi = -80;
+    uint16_t m_maxRtt = 1000;
+    uint8_t m_maxLoss = 25;
+    uint16_t m_paceGap = 0;
+    uint8_t m_paceBatch = 1;
+    unsigned long m_lastSend = 0; /* millis() the last paced send ended */
+    ESP8266LinkQuality m_quality = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, false};
+    uint32_t m_baud = 9600; /* the rate set by autoSetBaud or fastInit */
+    int8_t m_bulkRate = -1; /* index of the bulk rate in use, -1 if none */
+    unsigned long m_bulkStart = 0;
+    uint32_t m_bulkBytes = 0; /* bytes through tx_write and rx_read */
+    uint32_t m_bulkOverruns = 0; /* rx_overruns at beginBulk */
+    ESP8266RateStats m_rateStats[ESP8266_BULK_RATES] = {
+        {115200, 0, 0, 0, 0}, {57600, 0, 0, 0, 0}, {38400, 0, 0, 0, 0}, {19200, 0, 0, 0, 0}
+    };
+    uint32_t m_probeInterval = 0;
+    String m_superviseSsid;
+    String m_supervisePwd;
+
+    uint8_t *m_uplinkBuffer = NULL; /* Queued records of the uplink scheduler, NULL if disabled */
+    uint16_t m_uplinkSize = 0;
+    uint16_t m_uplinkLen = 0;
+    uint16_t m_uplinkRecords = 0;
+    unsigned long m_uplinkStart = 0; /* millis() of the oldest queued record */
+    uint32_t m_uplinkInterval = 0;
+    uint8_t m_uplinkSleep = ESP8266_SLEEP_NONE;
+    uint8_t m_wakePin = ESP8266_NO_PIN;
+    bool m_uplinkAsleep = false; /* the module sleeps in light or deep sleep until the next cycle */
+    bool m_uplinkFailed = false; /* the last cycle failed */
+    String m_uplinkHost;
+    uint32_t m_uplinkPort = 0;
+    ESP8266UplinkStats m_uplinkStats = {0, 0, 0, 0, 0, 0, 0};
+
+    ESP8266UartStats m_uartStats = {0, 0, 0, 0, 0, 0};
+    uint8_t *m_rxRing = NULL; /* The library RX buffer, NULL if disabled */
+    uint16_t m_rxRingSize = 0;
+    uint16_t m_rxHead = 0; /* the next byte to read */
+    uint16_t m_rxCount = 0;
+    uint8_t *m_trace = NULL; /* The trace ring, NULL if not recording */
+    uint16_t m_traceEntries = 0;
+    uint16_t m_traceHead = 0; /* the oldest entry */
+    uint16_t m_traceCount = 0;
+    uint32_t m_traceDropped = 0; /* entries overwritten by newer ones */
+    unsigned long m_traceLast = 0; /* micros() of the last entry */
+#ifndef ESP8266_USE_SOFTWARE_SERIAL
+    bool m_rxFull = false;
+    uint8_t m_rtsPin = ESP8266_NO_PIN;
+    uint8_t m_ctsPin = ESP8266_NO_PIN;
+    bool m_rtsHeld = false;
+#endif
+
     /*
      * +IPD,len:data
      * +IPD,id,len:data
@@ -487,7 +1939,19 @@ class ESP8266 {
 #else
     HardwareSerial *m_puart; /* The UART to communicate with ESP8266 */
 #endif
+    /*
+     * Commands are printed through tx_write, so they honor CTS and are traced like payload. 
+     */
+    class TxPrint : public Print {
+     public:
+        TxPrint(ESP8266 *owner): m_owner(owner) {}
+        size_t write(uint8_t c) { return m_owner->tx_write(c); }
+        using Print::write;
+     private:
+        ESP8266 *m_owner;
+    };
+    TxPrint m_tx{this};
 };
 
 #endif /* #ifndef __ESP8266_H__ */
-
+
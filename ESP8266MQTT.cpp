@@ -0,0 +1,439 @@
+/**
+   @file ESP8266MQTT.cpp
+   @brief The implementation of class ESP8266MQTT.
+
+   @par Copyright:
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version. \n\n
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include "ESP8266MQTT.h"
+
+/* Packet types(high nibble of the fixed header) */
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_PUBACK      0x40
+#define MQTT_SUBSCRIBE   0x82
+#define MQTT_SUBACK      0x90
+#define MQTT_PINGREQ     0xC0
+#define MQTT_PINGRESP    0xD0
+#define MQTT_DISCONNECT  0xE0
+
+/* Room left at the start of m_out for the fixed header */
+#define MQTT_HEADER_ROOM 5
+
+/* Parser states */
+#define MQTT_STATE_HEADER     0
+#define MQTT_STATE_LENGTH     1
+#define MQTT_STATE_TOPIC_LEN  2
+#define MQTT_STATE_TOPIC      3
+#define MQTT_STATE_PACKET_ID  4
+#define MQTT_STATE_PAYLOAD    5
+#define MQTT_STATE_BODY       6
+
+ESP8266MQTT::ESP8266MQTT(ESP8266 &wifi): m_wifi(&wifi), m_callback(NULL), m_connected(false),
+  m_connack(false), m_pingOutstanding(false), m_keepalive(0), m_lastSent(0), m_pingSent(0),
+  m_nextId(1), m_outLen(MQTT_HEADER_ROOM), m_state(MQTT_STATE_HEADER)
+{
+  memset(m_inflight, 0, sizeof(m_inflight));
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+bool ESP8266MQTT::connect(String host, uint32_t port, const char *client_id, const char *user,
+                          const char *pwd, uint16_t keepalive)
+{
+  static const uint8_t protocol[] = {0, 4, 'M', 'Q', 'T', 'T', 4};
+  uint8_t flags = 0x02; /* clean session */
+  uint8_t alive[2] = {(uint8_t)(keepalive >> 8), (uint8_t)keepalive};
+  unsigned long start;
+
+  m_connected = false;
+  m_connack = false;
+  m_pingOutstanding = false;
+  m_keepalive = keepalive;
+  m_state = MQTT_STATE_HEADER;
+  memset(m_inflight, 0, sizeof(m_inflight));
+
+  /* in active mode a +IPD frame longer than the receive buffer would be cut, and the parser lost */
+  if (!m_wifi->setPassiveRecv(true) || !m_wifi->createTCP(host, port)) {
+    return false;
+  }
+
+  if (user) {
+    flags |= 0x80;
+  }
+  if (pwd) {
+    flags |= 0x40;
+  }
+  m_outLen = MQTT_HEADER_ROOM;
+  if (!put(protocol, sizeof(protocol)) || !put(&flags, 1) || !put(alive, 2) || !putString(client_id)
+      || (user && !putString(user)) || (pwd && !putString(pwd)) || !sendPacket(MQTT_CONNECT, NULL, 0)) {
+    m_wifi->releaseTCP();
+    return false;
+  }
+
+  start = millis();
+  while (!m_connack && millis() - start < 5000) {
+    receive(100);
+  }
+  if (!m_connected) {
+    /* refused or no CONNACK: a new connect must not find the link "ALREADY CONNECT" */
+    m_wifi->releaseTCP();
+  }
+  return m_connected;
+}
+
+void ESP8266MQTT::disconnect(void)
+{
+  if (m_connected) {
+    m_outLen = MQTT_HEADER_ROOM;
+    sendPacket(MQTT_DISCONNECT, NULL, 0);
+  }
+  m_connected = false;
+  m_wifi->releaseTCP();
+}
+
+bool ESP8266MQTT::connected(void)
+{
+  return m_connected;
+}
+
+bool ESP8266MQTT::publish(const char *topic, const uint8_t *payload, uint16_t len, uint8_t qos, bool retain)
+{
+  int8_t slot = -1;
+  uint8_t id[2];
+
+  if (!m_connected) {
+    return false;
+  }
+  if (qos > 0) {
+    qos = 1;
+    for (uint8_t i = 0; i < ESP8266_MQTT_MAX_INFLIGHT; i++) {
+      if (m_inflight[i] == 0) {
+        slot = i;
+        break;
+      }
+    }
+    if (slot == -1) {
+      m_stats.window_full++;
+      return false;
+    }
+  }
+
+  m_outLen = MQTT_HEADER_ROOM;
+  if (!putString(topic)) {
+    return false;
+  }
+  if (qos > 0) {
+    id[0] = m_nextId >> 8;
+    id[1] = m_nextId;
+    if (!put(id, 2)) {
+      return false;
+    }
+  }
+  if (!sendPacket(MQTT_PUBLISH | (qos << 1) | (retain ? 1 : 0), payload, len)) {
+    return false;
+  }
+  if (qos > 0) {
+    m_inflight[slot] = m_nextId;
+    m_nextId = m_nextId == 0xFFFF ? 1 : m_nextId + 1;
+  }
+  m_stats.published++;
+  return true;
+}
+
+bool ESP8266MQTT::subscribe(const char *topic, uint8_t qos)
+{
+  uint8_t id[2] = {(uint8_t)(m_nextId >> 8), (uint8_t)m_nextId};
+  qos = qos > 0 ? 1 : 0;
+
+  if (!m_connected) {
+    return false;
+  }
+  m_outLen = MQTT_HEADER_ROOM;
+  if (!put(id, 2) || !putString(topic) || !put(&qos, 1)) {
+    return false;
+  }
+  m_nextId = m_nextId == 0xFFFF ? 1 : m_nextId + 1;
+  return sendPacket(MQTT_SUBSCRIBE, NULL, 0);
+}
+
+void ESP8266MQTT::setCallback(ESP8266MQTTCallback callback)
+{
+  m_callback = callback;
+}
+
+void ESP8266MQTT::loop(void)
+{
+  uint32_t period;
+
+  if (!m_connected) {
+    return;
+  }
+  receive(10);
+
+  if (m_keepalive == 0) {
+    return;
+  }
+  period = m_keepalive * 1000UL;
+  if (m_pingOutstanding && millis() - m_pingSent > period) {
+    /* no PINGRESP for a whole keep alive period: the broker or the link is gone */
+    m_connected = false;
+    m_wifi->releaseTCP();
+    return;
+  }
+  if (!m_pingOutstanding && millis() - m_lastSent >= period / 2) {
+    m_outLen = MQTT_HEADER_ROOM;
+    if (sendPacket(MQTT_PINGREQ, NULL, 0)) {
+      m_pingOutstanding = true;
+      m_pingSent = millis();
+      m_stats.pings++;
+    }
+  }
+}
+
+uint8_t ESP8266MQTT::inflight(void)
+{
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < ESP8266_MQTT_MAX_INFLIGHT; i++) {
+    if (m_inflight[i] != 0) {
+      n++;
+    }
+  }
+  return n;
+}
+
+ESP8266MQTTStats ESP8266MQTT::getStats(void)
+{
+  return m_stats;
+}
+
+bool ESP8266MQTT::put(const uint8_t *data, uint16_t len)
+{
+  if (m_outLen + len > ESP8266_MQTT_MAX_PACKET) {
+    return false;
+  }
+  memcpy(m_out + m_outLen, data, len);
+  m_outLen += len;
+  return true;
+}
+
+bool ESP8266MQTT::putString(const char *str)
+{
+  uint16_t len = strlen(str);
+  uint8_t prefix[2] = {(uint8_t)(len >> 8), (uint8_t)len};
+  return put(prefix, 2) && put((const uint8_t *)str, len);
+}
+
+bool ESP8266MQTT::sendPacket(uint8_t type, const uint8_t *payload, uint16_t payload_len)
+{
+  uint32_t remaining = (m_outLen - MQTT_HEADER_ROOM) + payload_len;
+  uint8_t header[MQTT_HEADER_ROOM];
+  uint8_t header_len = 0;
+  uint8_t *start;
+  bool ret;
+
+  header[header_len++] = type;
+  do {
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    header[header_len++] = remaining > 0 ? digit | 0x80 : digit;
+  } while (remaining > 0);
+
+  /* the fixed header goes right in front of the variable header */
+  start = m_out + MQTT_HEADER_ROOM - header_len;
+  memcpy(start, header, header_len);
+  if (payload_len == 0 || put(payload, payload_len)) {
+    /* one plain send, so QoS 0 publishes can be coalesced */
+    ret = m_wifi->send(start, m_outLen - (start - m_out));
+  } else {
+    /* a payload too large for m_out follows the headers in the same AT+CIPSEND */
+    ESP8266Segment segments[2] = {
+      {start, (uint16_t)(m_outLen - (start - m_out)), false},
+      {payload, payload_len, false}
+    };
+    ret = m_wifi->send(segments, 2);
+  }
+  m_outLen = MQTT_HEADER_ROOM;
+  if (ret) {
+    m_lastSent = millis();
+  }
+  return ret;
+}
+
+void ESP8266MQTT::receive(uint32_t timeout)
+{
+  uint8_t buffer[32];
+  if (m_wifi->recvPieces(buffer, sizeof(buffer), sink, this, timeout) > 0 && m_pingOutstanding) {
+    /* the broker is alive, its PINGRESP waits behind the data still coming */
+    m_pingSent = millis();
+  }
+}
+
+void ESP8266MQTT::sink(uint8_t *data, uint16_t len, void *context)
+{
+  ((ESP8266MQTT *)context)->parse(data, len);
+}
+
+void ESP8266MQTT::parse(const uint8_t *data, uint16_t len)
+{
+  uint16_t i = 0;
+  uint8_t c;
+
+  while (i < len) {
+    if (m_state == MQTT_STATE_PAYLOAD) {
+      uint16_t span = len - i;
+      if (span > m_remaining) {
+        span = m_remaining;
+      }
+      if (m_callback) {
+        m_callback(m_topic, data + i, span, m_payloadPos, m_payloadLen);
+      }
+      m_payloadPos += span;
+      m_remaining -= span;
+      i += span;
+      if (m_remaining == 0) {
+        dispatch();
+      }
+      continue;
+    }
+
+    c = data[i++];
+    switch (m_state) {
+      case MQTT_STATE_HEADER:
+        m_type = c;
+        m_remaining = 0;
+        m_lengthShift = 0;
+        m_bodyLen = 0;
+        m_state = MQTT_STATE_LENGTH;
+        break;
+
+      case MQTT_STATE_LENGTH:
+        m_remaining |= (uint32_t)(c & 0x7F) << m_lengthShift;
+        m_lengthShift += 7;
+        if (c & 0x80) {
+          break;
+        }
+        if (m_remaining == 0) {
+          dispatch();
+        } else if ((m_type & 0xF0) == MQTT_PUBLISH) {
+          m_topicLen = 0;
+          m_state = MQTT_STATE_TOPIC_LEN;
+        } else {
+          m_state = MQTT_STATE_BODY;
+        }
+        break;
+
+      case MQTT_STATE_TOPIC_LEN:
+        m_topicLen = (m_topicLen << 8) | c;
+        m_remaining--;
+        if (++m_bodyLen == 2) {
+          m_topicPos = 0;
+          m_state = MQTT_STATE_TOPIC;
+        }
+        break;
+
+      case MQTT_STATE_TOPIC:
+        if (m_topicPos < ESP8266_MQTT_MAX_TOPIC - 1) {
+          m_topic[m_topicPos] = c;
+        }
+        m_topicPos++;
+        m_remaining--;
+        break;
+
+      case MQTT_STATE_PACKET_ID:
+        m_packetId = (m_packetId << 8) | c;
+        m_remaining--;
+        m_bodyLen++;
+        break;
+
+      default: /* MQTT_STATE_BODY */
+        if (m_bodyLen < sizeof(m_body)) {
+          m_body[m_bodyLen] = c;
+        }
+        m_bodyLen++;
+        if (--m_remaining == 0) {
+          dispatch();
+        }
+        break;
+    }
+
+    /* the end of the PUBLISH variable header */
+    if (m_state == MQTT_STATE_TOPIC && m_topicPos >= m_topicLen) {
+      m_topic[m_topicPos < ESP8266_MQTT_MAX_TOPIC ? m_topicPos : ESP8266_MQTT_MAX_TOPIC - 1] = '\0';
+      if (m_type & 0x06) {
+        m_packetId = 0;
+        m_bodyLen = 0;
+        m_state = MQTT_STATE_PACKET_ID;
+        continue;
+      }
+      m_state = MQTT_STATE_PAYLOAD;
+    } else if (m_state == MQTT_STATE_PACKET_ID && m_bodyLen == 2) {
+      m_state = MQTT_STATE_PAYLOAD;
+    }
+    if (m_state == MQTT_STATE_PAYLOAD) {
+      m_payloadLen = m_remaining;
+      m_payloadPos = 0;
+      if (m_remaining == 0) {
+        if (m_callback) {
+          m_callback(m_topic, data + i, 0, 0, 0);
+        }
+        dispatch();
+      }
+    }
+  }
+}
+
+void ESP8266MQTT::dispatch(void)
+{
+  uint16_t id;
+  uint8_t ack[4];
+
+  switch (m_type & 0xF0) {
+    case MQTT_CONNACK:
+      m_connack = true;
+      m_connected = m_bodyLen >= 2 && m_body[1] == 0;
+      break;
+
+    case MQTT_PUBLISH:
+      m_stats.received++;
+      if (m_type & 0x06) {
+        ack[0] = MQTT_PUBACK;
+        ack[1] = 2;
+        ack[2] = m_packetId >> 8;
+        ack[3] = m_packetId;
+        if (m_wifi->send(ack, sizeof(ack))) {
+          m_lastSent = millis();
+        }
+      }
+      break;
+
+    case MQTT_PUBACK:
+      id = ((uint16_t)m_body[0] << 8) | m_body[1];
+      for (uint8_t i = 0; i < ESP8266_MQTT_MAX_INFLIGHT; i++) {
+        if (m_inflight[i] == id) {
+          m_inflight[i] = 0;
+          m_stats.acked++;
+          break;
+        }
+      }
+      break;
+
+    case MQTT_PINGRESP:
+      m_pingOutstanding = false;
+      break;
+
+    default: /* SUBACK and the rest need nothing */
+      break;
+  }
+  m_state = MQTT_STATE_HEADER;
+}
@@ -0,0 +1,206 @@
+/**
+ * @file ESP8266MQTT.h
+ * @brief The definition of class ESP8266MQTT.
+ *
+ * @par Copyright:
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266MQTT_H__
+#define __ESP8266MQTT_H__
+
+#include "ESP8266.h"
+
+/* Longest topic kept for the callback, longer topics are cut */
+#define ESP8266_MQTT_MAX_TOPIC      64
+
+/* Size of the buffer packets are built in, larger payloads follow it in the same AT+CIPSEND */
+#define ESP8266_MQTT_MAX_PACKET     128
+
+/* QoS 1 publishes which may wait for PUBACK at the same time */
+#define ESP8266_MQTT_MAX_INFLIGHT   4
+
+/**
+ * Called for incoming PUBLISH, once per received piece of the payload.
+ *
+ * @param topic - the topic of the message(cut to ESP8266_MQTT_MAX_TOPIC - 1 chars).
+ * @param payload - this piece of the payload.
+ * @param len - the length of this piece.
+ * @param offset - the position of this piece in the payload.
+ * @param total - the length of the whole payload.
+ */
+typedef void (*ESP8266MQTTCallback)(const char *topic, const uint8_t *payload, uint16_t len,
+                                    uint32_t offset, uint32_t total);
+
+/**
+ * Counters of the MQTT client.
+ */
+struct ESP8266MQTTStats {
+    uint32_t published;     /* PUBLISH sent */
+    uint32_t acked;         /* PUBACK received for QoS 1 publishes */
+    uint32_t received;      /* PUBLISH received */
+    uint32_t pings;         /* PINGREQ sent */
+    uint32_t window_full;   /* QoS 1 publishes refused because of the in-flight window */
+};
+
+/**
+ * MQTT 3.1.1 client over the single connection TCP of ESP8266.
+ */
+class ESP8266MQTT {
+ public:
+    /*
+     * Constuctor.
+     *
+     * @param wifi - the ESP8266 to connect through(single connection mode).
+     */
+    ESP8266MQTT(ESP8266 &wifi);
+
+    /**
+     * Connect to a broker.
+     *
+     * Passive receive mode is enabled, so large PUBLISH payloads are pulled in small pieces and
+     * streamed to the callback. Firmware without AT+CIPRECVMODE is not supported.
+     *
+     * @param host - the IP or domain name of the broker.
+     * @param port - the port number of the broker(default: 1883).
+     * @param client_id - the client identifier.
+     * @param user - the user name, NULL for none.
+     * @param pwd - the password, NULL for none.
+     * @param keepalive - the keep alive interval by second(default: 60).
+     * @retval true - CONNACK accepted.
+     * @retval false - failure(the TCP connection is closed again), or no passive receive mode.
+     */
+    bool connect(String host, uint32_t port, const char *client_id, const char *user = NULL,
+                 const char *pwd = NULL, uint16_t keepalive = 60);
+
+    /**
+     * Send DISCONNECT and close the connection.
+     */
+    void disconnect(void);
+
+    /**
+     * Whether the session is connected.
+     */
+    bool connected(void);
+
+    /**
+     * Publish a message.
+     *
+     * QoS 0 publishes are not waited for, so they can be sent back to back. A QoS 1 publish
+     * takes a slot of the in-flight window until its PUBACK is seen by loop.
+     *
+     * @param topic - the topic.
+     * @param payload - the payload.
+     * @param len - the length of payload.
+     * @param qos - 0 or 1.
+     * @param retain - the retain flag.
+     * @retval true - sent.
+     * @retval false - failure or the in-flight window is full.
+     */
+    bool publish(const char *topic, const uint8_t *payload, uint16_t len, uint8_t qos = 0, bool retain = false);
+
+    /**
+     * Subscribe to a topic filter. Messages are passed to the callback by loop.
+     *
+     * @param topic - the topic filter.
+     * @param qos - the requested QoS(0 or 1).
+     * @retval true - sent.
+     * @retval false - failure.
+     */
+    bool subscribe(const char *topic, uint8_t qos = 0);
+
+    /**
+     * Set the callback of incoming PUBLISH.
+     */
+    void setCallback(ESP8266MQTTCallback callback);
+
+    /**
+     * Receive and handle incoming packets and keep the session alive. Call it from loop().
+     *
+     * The connection is closed when a PINGREQ got no PINGRESP and nothing else came from the
+     * broker for a whole keep alive interval.
+     */
+    void loop(void);
+
+    /**
+     * Number of QoS 1 publishes waiting for PUBACK.
+     */
+    uint8_t inflight(void);
+
+    /**
+     * Get the counters of the client.
+     */
+    ESP8266MQTTStats getStats(void);
+
+ private:
+    /*
+     * Append bytes to the packet being built, false if it does not fit.
+     */
+    bool put(const uint8_t *data, uint16_t len);
+    bool putString(const char *str);
+
+    /*
+     * Send the packet built in m_out with the fixed header type, followed by payload.
+     */
+    bool sendPacket(uint8_t type, const uint8_t *payload, uint16_t payload_len);
+
+    /*
+     * Feed received bytes to the packet parser.
+     */
+    void parse(const uint8_t *data, uint16_t len);
+
+    /*
+     * Handle a packet whose body was parsed completely.
+     */
+    void dispatch(void);
+
+    /*
+     * Receive pending data for up to timeout ms.
+     */
+    void receive(uint32_t timeout);
+
+    /*
+     * Pass a piece pulled by receive to the parser of the client in context.
+     */
+    static void sink(uint8_t *data, uint16_t len, void *context);
+
+    ESP8266 *m_wifi;
+    ESP8266MQTTCallback m_callback;
+    bool m_connected;
+    bool m_connack;
+    bool m_pingOutstanding;
+    uint16_t m_keepalive;
+    unsigned long m_lastSent;
+    unsigned long m_pingSent;
+    uint16_t m_nextId;
+    uint16_t m_inflight[ESP8266_MQTT_MAX_INFLIGHT]; /* packet ids waiting for PUBACK, 0 if free */
+    ESP8266MQTTStats m_stats;
+
+    uint8_t m_out[ESP8266_MQTT_MAX_PACKET];
+    uint16_t m_outLen;
+
+    /* parser state */
+    uint8_t m_state;
+    uint8_t m_type;                 /* the first byte of the fixed header */
+    uint32_t m_remaining;           /* bytes of the body not parsed yet */
+    uint8_t m_lengthShift;
+    uint16_t m_topicLen;
+    uint16_t m_topicPos;
+    uint16_t m_packetId;
+    uint32_t m_payloadLen;
+    uint32_t m_payloadPos;
+    uint8_t m_body[4];              /* the start of bodies other than PUBLISH */
+    uint8_t m_bodyLen;
+    char m_topic[ESP8266_MQTT_MAX_TOPIC];
+};
+
+#endif /* #ifndef __ESP8266MQTT_H__ */
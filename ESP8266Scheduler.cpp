@@ -0,0 +1,207 @@
+/**
+   @file ESP8266Scheduler.cpp
+   @brief The implementation of class ESP8266Scheduler.
+
+   @par Copyright:
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version. \n\n
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include "ESP8266Scheduler.h"
+
+ESP8266Scheduler::ESP8266Scheduler(void): m_count(0), m_active(-1), m_next(0), m_listening(-1),
+  m_busySince(0), m_busy(false), m_switches(0), m_busyTime(0)
+{
+
+}
+
+int8_t ESP8266Scheduler::add(ESP8266 &wifi, uint8_t *buffer, uint16_t size, int8_t mux_id)
+{
+  Module *m;
+  if (m_count == ESP8266_SCHEDULER_MAX || buffer == NULL || size == 0) {
+    return -1;
+  }
+  m = &m_modules[m_count];
+  m->wifi = &wifi;
+  m->buffer = buffer;
+  m->size = size;
+  m->len = 0;
+  m->inflight = 0;
+  m->mux_id = mux_id;
+  m->consecutive = 0;
+  m->next_attempt = 0;
+  memset(&m->stats, 0, sizeof(m->stats));
+  return m_count++;
+}
+
+bool ESP8266Scheduler::queue(uint8_t module, const uint8_t *data, uint16_t len)
+{
+  Module *m;
+  if (module >= m_count) {
+    return false;
+  }
+  m = &m_modules[module];
+  if (m->len + len > m->size) {
+    m->stats.dropped += len;
+    return false;
+  }
+  /* appended behind the bytes in flight, which stay where they are */
+  memcpy(m->buffer + m->len, data, len);
+  m->len += len;
+  return true;
+}
+
+uint16_t ESP8266Scheduler::pending(uint8_t module)
+{
+  return module < m_count ? m_modules[module].len : 0;
+}
+
+void ESP8266Scheduler::poll(void)
+{
+  bool busy = false;
+
+#ifdef ESP8266_USE_SOFTWARE_SERIAL
+  /* one module at a time: finish its turn, then give the next turn round robin */
+  if (m_active >= 0 && advance(m_active)) {
+    m_active = -1;
+  }
+  for (uint8_t k = 0; m_active < 0 && k < m_count; k++) {
+    uint8_t i = (m_next + k) % m_count;
+    if (ready(i) && start(i)) {
+      m_active = i;
+      m_next = (i + 1) % m_count;
+    }
+  }
+  busy = m_active >= 0;
+#else
+  /* every module has its own UART: all sends run side by side */
+  for (uint8_t i = 0; i < m_count; i++) {
+    Module *m = &m_modules[i];
+    if (m->inflight > 0) {
+      advance(i);
+    } else if (ready(i)) {
+      start(i);
+    }
+    busy = busy || m->inflight > 0;
+  }
+#endif
+
+  if (busy && !m_busy) {
+    m_busySince = millis();
+  } else if (!busy && m_busy) {
+    m_busyTime += millis() - m_busySince;
+  }
+  m_busy = busy;
+}
+
+bool ESP8266Scheduler::start(uint8_t module)
+{
+  Module *m = &m_modules[module];
+  uint16_t len = m->len;
+
+#ifdef ESP8266_USE_SOFTWARE_SERIAL
+  if (len > ESP8266_SCHEDULER_SLICE) {
+    len = ESP8266_SCHEDULER_SLICE;
+  }
+  if (m_listening != (int8_t)module) {
+    /* sendBegin makes the module the listening one */
+    m_switches++;
+    m_listening = module;
+  }
+#endif
+  if (len > ESP8266_MAX_CIPSEND) {
+    len = ESP8266_MAX_CIPSEND;
+  }
+  if (!m->wifi->sendBegin(m->buffer, len, m->mux_id)) {
+    failed(module);
+    return false;
+  }
+  m->inflight = len;
+  return true;
+}
+
+bool ESP8266Scheduler::advance(uint8_t module)
+{
+  Module *m = &m_modules[module];
+  int8_t status = m->wifi->sendPoll();
+
+  if (status == ESP8266_PENDING) {
+    return false;
+  }
+  if (status == ESP8266_SUCCESS) {
+    m->len -= m->inflight;
+    memmove(m->buffer, m->buffer + m->inflight, m->len);
+    m->stats.bytes += m->inflight;
+    m->stats.sends++;
+    m->consecutive = 0;
+  } else {
+    /* the data stays queued and goes with a turn after the backoff */
+    failed(module);
+  }
+  m->inflight = 0;
+  return true;
+}
+
+void ESP8266Scheduler::failed(uint8_t module)
+{
+  Module *m = &m_modules[module];
+  uint32_t wait = ESP8266_SCHEDULER_RETRY_BASE;
+
+  m->stats.failures++;
+  if (m->consecutive < 0xFF) {
+    m->consecutive++;
+  }
+  for (uint8_t i = 1; i < m->consecutive && wait < ESP8266_SCHEDULER_RETRY_MAX; i++) {
+    wait *= 2;
+  }
+  if (wait > ESP8266_SCHEDULER_RETRY_MAX) {
+    wait = ESP8266_SCHEDULER_RETRY_MAX;
+  }
+  m->next_attempt = millis() + wait;
+}
+
+bool ESP8266Scheduler::ready(uint8_t module)
+{
+  Module *m = &m_modules[module];
+  return m->len > 0 && (m->consecutive == 0 || (long)(millis() - m->next_attempt) >= 0);
+}
+
+ESP8266SchedulerStats ESP8266Scheduler::getStats(uint8_t module)
+{
+  ESP8266SchedulerStats stats = {0, 0, 0, 0, 0, 0};
+  if (module < m_count) {
+    stats = m_modules[module].stats;
+  }
+  return stats;
+}
+
+ESP8266SchedulerStats ESP8266Scheduler::getStats(void)
+{
+  ESP8266SchedulerStats stats = {0, 0, 0, 0, 0, 0};
+  for (uint8_t i = 0; i < m_count; i++) {
+    stats.bytes += m_modules[i].stats.bytes;
+    stats.sends += m_modules[i].stats.sends;
+    stats.failures += m_modules[i].stats.failures;
+    stats.dropped += m_modules[i].stats.dropped;
+  }
+  stats.switches = m_switches;
+  stats.busy_time = m_busyTime + (m_busy ? millis() - m_busySince : 0);
+  return stats;
+}
+
+uint32_t ESP8266Scheduler::throughput(void)
+{
+  ESP8266SchedulerStats stats = getStats();
+  if (stats.busy_time == 0) {
+    return 0;
+  }
+  return (uint64_t)stats.bytes * 1000 / stats.busy_time;
+}
@@ -0,0 +1,161 @@
+/**
+ * @file ESP8266Scheduler.h
+ * @brief The definition of class ESP8266Scheduler.
+ *
+ * @par Copyright:
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266SCHEDULER_H__
+#define __ESP8266SCHEDULER_H__
+
+#include "ESP8266.h"
+
+/* Most modules one scheduler drives */
+#define ESP8266_SCHEDULER_MAX       4
+
+/* Most bytes one module sends before the next one gets its turn(SoftwareSerial) */
+#define ESP8266_SCHEDULER_SLICE     256
+
+/* Wait before sending again after the first failed AT+CIPSEND by ms, doubled for each next one */
+#define ESP8266_SCHEDULER_RETRY_BASE    50
+
+/* Longest wait before sending again after failed AT+CIPSEND by ms */
+#define ESP8266_SCHEDULER_RETRY_MAX     2000
+
+/**
+ * Counters of one module, or of all modules together.
+ */
+struct ESP8266SchedulerStats {
+    uint32_t bytes;             /* payload bytes sent */
+    uint32_t sends;             /* AT+CIPSEND completed */
+    uint32_t failures;          /* AT+CIPSEND failed, the data is sent again after a backoff */
+    uint32_t dropped;           /* bytes refused by queue because the buffer was full */
+    uint32_t switches;          /* listen() switches between SoftwareSerial modules */
+    uint32_t busy_time;         /* ms with at least one send in progress */
+};
+
+/**
+ * Drives the sends of several ESP8266 modules at the same time.
+ *
+ * Every module gets a queue in a caller supplied buffer. poll starts an AT+CIPSEND for the
+ * queued data of each idle module and advances all sends in progress without blocking, so
+ * with HardwareSerial(e.g. Serial1..3 of a Mega) the modules work in parallel and the total
+ * uplink grows with their number.
+ *
+ * SoftwareSerial can receive on one port only, and sending on any port blocks receiving, so
+ * there the modules take turns: round robin, at most ESP8266_SCHEDULER_SLICE bytes per turn,
+ * with the listening port switched for each turn.
+ *
+ * A module whose send fails keeps its data queued and waits before the next attempt,
+ * ESP8266_SCHEDULER_RETRY_BASE ms doubled for each further failure up to
+ * ESP8266_SCHEDULER_RETRY_MAX ms, so a dead link does not cost an AT+CIPSEND on every poll.
+ */
+class ESP8266Scheduler {
+ public:
+    /*
+     * Constuctor.
+     */
+    ESP8266Scheduler(void);
+
+    /**
+     * Add a module connected already(single mode TCP, or the link mux_id in multiple mode).
+     *
+     * @param wifi - the module.
+     * @param buffer - the queue of the module, owned by the caller.
+     * @param size - the size of buffer.
+     * @param mux_id - the link in multiple mode, -1 in single mode.
+     * @return the index of the module for queue, -1 if ESP8266_SCHEDULER_MAX are added already.
+     */
+    int8_t add(ESP8266 &wifi, uint8_t *buffer, uint16_t size, int8_t mux_id = -1);
+
+    /**
+     * Queue data for a module. Returns at once, poll sends it.
+     *
+     * @param module - the index returned by add.
+     * @param data - the data.
+     * @param len - the length of data.
+     * @retval true - queued.
+     * @retval false - it does not fit in the rest of the buffer.
+     */
+    bool queue(uint8_t module, const uint8_t *data, uint16_t len);
+
+    /**
+     * Bytes queued for a module and not sent yet.
+     */
+    uint16_t pending(uint8_t module);
+
+    /**
+     * Start and advance the sends of all modules. Call it from loop() as often as possible.
+     */
+    void poll(void);
+
+    /**
+     * Get the counters of one module.
+     */
+    ESP8266SchedulerStats getStats(uint8_t module);
+
+    /**
+     * Get the counters of all modules together.
+     */
+    ESP8266SchedulerStats getStats(void);
+
+    /**
+     * The aggregate throughput: payload bytes per second while sends were in progress.
+     */
+    uint32_t throughput(void);
+
+ private:
+    struct Module {
+        ESP8266 *wifi;
+        uint8_t *buffer;
+        uint16_t size;
+        uint16_t len;           /* bytes queued */
+        uint16_t inflight;      /* bytes at the start of buffer being sent */
+        int8_t mux_id;
+        uint8_t consecutive;        /* failed sends since the last success */
+        unsigned long next_attempt; /* millis() before which no send is started */
+        ESP8266SchedulerStats stats;
+    };
+
+    /*
+     * Start a send of the queue of a module.
+     */
+    bool start(uint8_t module);
+
+    /*
+     * Advance the send of a module, true when it is finished.
+     */
+    bool advance(uint8_t module);
+
+    /*
+     * Count a failed send of a module and put off its next one.
+     */
+    void failed(uint8_t module);
+
+    /*
+     * Whether a module has queued data and its backoff is over.
+     */
+    bool ready(uint8_t module);
+
+    Module m_modules[ESP8266_SCHEDULER_MAX];
+    uint8_t m_count;
+    int8_t m_active;            /* the module having the turn(SoftwareSerial), -1 if none */
+    uint8_t m_next;             /* the module to consider first for the next turn */
+    int8_t m_listening;         /* the module listening(SoftwareSerial), -1 if unknown */
+    unsigned long m_busySince;  /* millis() the current busy period started */
+    bool m_busy;
+    uint32_t m_switches;
+    uint32_t m_busyTime;
+};
+
+#endif /* #ifndef __ESP8266SCHEDULER_H__ */
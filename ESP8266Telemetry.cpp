@@ -0,0 +1,165 @@
+/**
+   @file ESP8266Telemetry.cpp
+   @brief The implementation of class ESP8266TelemetryEncoder and ESP8266TelemetryDecoder.
+
+   @par Copyright:
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version. \n\n
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include "ESP8266Telemetry.h"
+
+/*
+ * The arithmetic is done on uint32_t so deltas wrap instead of overflowing, and the decoder
+ * undoes them exactly.
+ */
+static uint32_t zigzag(uint32_t x)
+{
+  return (x << 1) ^ (0 - (x >> 31));
+}
+
+static uint32_t unzigzag(uint32_t z)
+{
+  return (z >> 1) ^ (0 - (z & 1));
+}
+
+ESP8266TelemetryEncoder::ESP8266TelemetryEncoder(const ESP8266FieldEncoding *fields, uint8_t count, uint8_t tag):
+  m_fields(fields), m_count(count > ESP8266_TELEMETRY_MAX_FIELDS ? ESP8266_TELEMETRY_MAX_FIELDS : count), m_tag(tag)
+{
+
+}
+
+bool ESP8266TelemetryEncoder::begin(uint8_t *buffer, uint16_t size)
+{
+  m_buffer = buffer;
+  m_size = size;
+  m_len = 0;
+  m_records = 0;
+  for (uint8_t i = 0; i < m_count; i++) {
+    m_prev[i] = 0;
+    m_prevDelta[i] = 0;
+  }
+  if (buffer == NULL || size == 0) {
+    return false;
+  }
+  m_buffer[m_len++] = m_tag;
+  return true;
+}
+
+bool ESP8266TelemetryEncoder::add(const int32_t *values)
+{
+  uint16_t len = m_len;
+  uint32_t delta[ESP8266_TELEMETRY_MAX_FIELDS];
+
+  if (m_buffer == NULL) {
+    return false;
+  }
+  for (uint8_t i = 0; i < m_count; i++) {
+    uint32_t x = (uint32_t)values[i];
+    delta[i] = x - (uint32_t)m_prev[i];
+    if (m_fields[i] == ESP8266_FIELD_DELTA) {
+      x = delta[i];
+    } else if (m_fields[i] == ESP8266_FIELD_DELTA2) {
+      x = delta[i] - (uint32_t)m_prevDelta[i];
+    }
+    x = zigzag(x);
+    do {
+      if (len >= m_size) {
+        return false; /* m_len and the previous values are untouched until the record fits */
+      }
+      m_buffer[len++] = (x > 0x7F ? 0x80 : 0) | (x & 0x7F);
+      x >>= 7;
+    } while (x);
+  }
+
+  for (uint8_t i = 0; i < m_count; i++) {
+    m_prev[i] = values[i];
+    m_prevDelta[i] = (int32_t)delta[i];
+  }
+  m_len = len;
+  m_records++;
+  return true;
+}
+
+uint16_t ESP8266TelemetryEncoder::length(void)
+{
+  return m_len;
+}
+
+uint16_t ESP8266TelemetryEncoder::records(void)
+{
+  return m_records;
+}
+
+ESP8266TelemetryDecoder::ESP8266TelemetryDecoder(const ESP8266FieldEncoding *fields, uint8_t count, uint8_t tag):
+  m_fields(fields), m_count(count > ESP8266_TELEMETRY_MAX_FIELDS ? ESP8266_TELEMETRY_MAX_FIELDS : count), m_tag(tag)
+{
+
+}
+
+bool ESP8266TelemetryDecoder::begin(const uint8_t *data, uint16_t len)
+{
+  m_data = data;
+  m_len = len;
+  m_pos = 0;
+  for (uint8_t i = 0; i < m_count; i++) {
+    m_prev[i] = 0;
+    m_prevDelta[i] = 0;
+  }
+  if (data == NULL || len == 0 || data[0] != m_tag) {
+    m_len = 0;
+    return false;
+  }
+  m_pos = 1;
+  return true;
+}
+
+bool ESP8266TelemetryDecoder::next(int32_t *values)
+{
+  uint16_t pos = m_pos;
+  uint32_t x;
+  uint32_t delta;
+
+  if (pos >= m_len) {
+    return false;
+  }
+  for (uint8_t i = 0; i < m_count; i++) {
+    uint8_t shift = 0;
+    uint8_t c;
+
+    x = 0;
+    do {
+      if (pos >= m_len || shift > 28) {
+        return false;
+      }
+      c = m_data[pos++];
+      x |= (uint32_t)(c & 0x7F) << shift;
+      shift += 7;
+    } while (c & 0x80);
+    x = unzigzag(x);
+
+    if (m_fields[i] == ESP8266_FIELD_DELTA) {
+      delta = x;
+    } else if (m_fields[i] == ESP8266_FIELD_DELTA2) {
+      delta = x + (uint32_t)m_prevDelta[i];
+    } else {
+      delta = x - (uint32_t)m_prev[i];
+    }
+    values[i] = (int32_t)((uint32_t)m_prev[i] + delta);
+  }
+
+  for (uint8_t i = 0; i < m_count; i++) {
+    m_prevDelta[i] = (int32_t)((uint32_t)values[i] - (uint32_t)m_prev[i]);
+    m_prev[i] = values[i];
+  }
+  m_pos = pos;
+  return true;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file ESP8266Telemetry.h
+ * @brief The definition of class ESP8266TelemetryEncoder and ESP8266TelemetryDecoder.
+ *
+ * @par Copyright:
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266TELEMETRY_H__
+#define __ESP8266TELEMETRY_H__
+
+/* No Arduino dependency: the decoder is built on the host as well(see extras/telemetry_decode) */
+#include <stdint.h>
+#include <stddef.h>
+
+/* Most fields of one record */
+#define ESP8266_TELEMETRY_MAX_FIELDS    8
+
+/**
+ * How a field is written. Every value is a signed 32 bit integer: scale fractional readings
+ * to fixed point(e.g. 21.37 C as 2137) before adding them.
+ */
+enum ESP8266FieldEncoding {
+    ESP8266_FIELD_ABSOLUTE = 0, /* the value itself, for readings which jump around */
+    ESP8266_FIELD_DELTA,        /* the change since the previous record, for slowly moving readings */
+    ESP8266_FIELD_DELTA2,       /* the change of that change, for timestamps and counters with a steady rate */
+};
+
+/**
+ * Builds a batch of records into a caller supplied buffer.
+ *
+ * A batch is one schema tag byte followed by records. A record is one zigzag varint per field,
+ * 1 byte for values within -64..63. Deltas restart at every batch, so each batch decodes on its
+ * own and a lost batch costs only its own records.
+ */
+class ESP8266TelemetryEncoder {
+ public:
+    /*
+     * Constuctor.
+     *
+     * @param fields - the encoding of each field, must outlive the encoder.
+     * @param count - the number of fields(at most ESP8266_TELEMETRY_MAX_FIELDS).
+     * @param tag - the schema tag written at the start of each batch.
+     */
+    ESP8266TelemetryEncoder(const ESP8266FieldEncoding *fields, uint8_t count, uint8_t tag = 0);
+
+    /**
+     * Start a batch in buffer.
+     *
+     * @param buffer - the buffer the batch is built in.
+     * @param size - the size of buffer.
+     * @retval true - success.
+     * @retval false - no room even for the tag.
+     */
+    bool begin(uint8_t *buffer, uint16_t size);
+
+    /**
+     * Append a record.
+     *
+     * @param values - one value per field.
+     * @retval true - appended.
+     * @retval false - the record does not fit; the batch is left as it was, so send it and begin again.
+     */
+    bool add(const int32_t *values);
+
+    /**
+     * The bytes of the batch so far, to be passed to send or queueUplink.
+     */
+    uint16_t length(void);
+
+    /**
+     * The records of the batch so far.
+     */
+    uint16_t records(void);
+
+ private:
+    const ESP8266FieldEncoding *m_fields;
+    uint8_t m_count;
+    uint8_t m_tag;
+    uint8_t *m_buffer = NULL;
+    uint16_t m_size = 0;
+    uint16_t m_len = 0;
+    uint16_t m_records = 0;
+    int32_t m_prev[ESP8266_TELEMETRY_MAX_FIELDS];
+    int32_t m_prevDelta[ESP8266_TELEMETRY_MAX_FIELDS];
+};
+
+/**
+ * Reads back the records of a batch built by ESP8266TelemetryEncoder with the same schema.
+ */
+class ESP8266TelemetryDecoder {
+ public:
+    /*
+     * Constuctor.
+     *
+     * @param fields - the encoding of each field, the same as the encoder's.
+     * @param count - the number of fields.
+     * @param tag - the schema tag expected at the start of each batch.
+     */
+    ESP8266TelemetryDecoder(const ESP8266FieldEncoding *fields, uint8_t count, uint8_t tag = 0);
+
+    /**
+     * Start reading a batch.
+     *
+     * @param data - the batch.
+     * @param len - the length of data.
+     * @retval true - success.
+     * @retval false - empty, or built with another schema tag.
+     */
+    bool begin(const uint8_t *data, uint16_t len);
+
+    /**
+     * Read the next record.
+     *
+     * @param values - one value per field.
+     * @retval true - a record was read.
+     * @retval false - the end of the batch, or a truncated record.
+     */
+    bool next(int32_t *values);
+
+ private:
+    const ESP8266FieldEncoding *m_fields;
+    uint8_t m_count;
+    uint8_t m_tag;
+    const uint8_t *m_data = NULL;
+    uint16_t m_len = 0;
+    uint16_t m_pos = 0;
+    int32_t m_prev[ESP8266_TELEMETRY_MAX_FIELDS];
+    int32_t m_prevDelta[ESP8266_TELEMETRY_MAX_FIELDS];
+};
+
+#endif /* #ifndef __ESP8266TELEMETRY_H__ */
@@ -0,0 +1,355 @@
+/**
+   @file ESP8266WebSocket.cpp
+   @brief The implementation of class ESP8266WebSocket.
+
+   @par Copyright:
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version. \n\n
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include "ESP8266WebSocket.h"
+
+/* Longest frame header sent: 2 bytes, 16 bit length, mask key */
+#define WS_HEADER_MAX  8
+
+/* Parser states */
+#define WS_STATE_HEADER1  0
+#define WS_STATE_HEADER2  1
+#define WS_STATE_LENGTH   2
+#define WS_STATE_MASK     3
+#define WS_STATE_PAYLOAD  4
+
+static const char ws_base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+ESP8266WebSocket::ESP8266WebSocket(ESP8266 &wifi): m_wifi(&wifi), m_callback(NULL), m_connected(false),
+  m_handshake(false), m_upgraded(false), m_pingOutstanding(false), m_pingInterval(0), m_pingSent(0),
+  m_state(WS_STATE_HEADER1)
+{
+
+}
+
+bool ESP8266WebSocket::connect(String host, uint32_t port, String path, uint32_t timeout)
+{
+  const uint8_t nonce_len = 16;
+  String request;
+  uint8_t nonce[nonce_len];
+  unsigned long start;
+
+  m_connected = false;
+  m_pingOutstanding = false;
+  m_handshake = true;
+  m_upgraded = false;
+  m_matched = 0;
+  m_statusLen = 0;
+  m_state = WS_STATE_HEADER1;
+
+  /* in active mode a +IPD frame longer than the receive buffer would be cut, and the parser lost */
+  if (!m_wifi->setPassiveRecv(true) || !m_wifi->createTCP(host, port)) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < nonce_len; i++) {
+    nonce[i] = random(256);
+  }
+  request = "GET ";
+  request += path;
+  request += " HTTP/1.1\r\nHost: ";
+  request += host;
+  request += "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: ";
+  /* 16 bytes are 5 groups of 3 and one byte left: 24 characters with "==" */
+  for (uint8_t i = 0; i < nonce_len; i += 3) {
+    uint32_t group = (uint32_t)nonce[i] << 16;
+    if (i + 1 < nonce_len) {
+      group |= (uint32_t)nonce[i + 1] << 8 | nonce[i + 2];
+    }
+    request += ws_base64[(group >> 18) & 0x3F];
+    request += ws_base64[(group >> 12) & 0x3F];
+    request += i + 1 < nonce_len ? ws_base64[(group >> 6) & 0x3F] : '=';
+    request += i + 1 < nonce_len ? ws_base64[group & 0x3F] : '=';
+  }
+  request += "\r\n\r\n";
+  if (!m_wifi->send((const uint8_t *)request.c_str(), request.length())) {
+    m_wifi->releaseTCP();
+    return false;
+  }
+
+  start = millis();
+  while (m_handshake && millis() - start < timeout) {
+    receive(100);
+  }
+  m_connected = !m_handshake && m_upgraded;
+  m_pingSent = millis();
+  if (!m_connected) {
+    m_wifi->releaseTCP();
+  }
+  return m_connected;
+}
+
+void ESP8266WebSocket::disconnect(void)
+{
+  if (m_connected) {
+    sendFrame(ESP8266_WS_CLOSE, true, NULL, 0);
+  }
+  m_connected = false;
+  m_wifi->releaseTCP();
+}
+
+bool ESP8266WebSocket::connected(void)
+{
+  return m_connected;
+}
+
+bool ESP8266WebSocket::sendText(const char *text)
+{
+  return sendMessage(ESP8266_WS_TEXT, (const uint8_t *)text, strlen(text));
+}
+
+bool ESP8266WebSocket::sendBinary(const uint8_t *data, uint32_t len)
+{
+  return sendMessage(ESP8266_WS_BINARY, data, len);
+}
+
+bool ESP8266WebSocket::ping(void)
+{
+  if (!sendFrame(ESP8266_WS_PING, true, NULL, 0)) {
+    return false;
+  }
+  m_pingOutstanding = true;
+  m_pingSent = millis();
+  return true;
+}
+
+void ESP8266WebSocket::setPingInterval(uint32_t interval)
+{
+  m_pingInterval = interval;
+  m_pingSent = millis();
+}
+
+void ESP8266WebSocket::setCallback(ESP8266WebSocketCallback callback)
+{
+  m_callback = callback;
+}
+
+void ESP8266WebSocket::loop(void)
+{
+  if (!m_connected) {
+    return;
+  }
+  receive(10);
+  if (m_connected && m_pingInterval > 0 && millis() - m_pingSent >= m_pingInterval) {
+    if (m_pingOutstanding) {
+      /* no pong for a whole interval: the server or the link is gone */
+      m_connected = false;
+      m_wifi->releaseTCP();
+      return;
+    }
+    ping();
+  }
+}
+
+bool ESP8266WebSocket::sendMessage(uint8_t opcode, const uint8_t *data, uint32_t len)
+{
+  const uint16_t chunk = ESP8266_WS_MAX_FRAME - WS_HEADER_MAX;
+  uint32_t sent = 0;
+
+  if (!m_connected) {
+    return false;
+  }
+  do {
+    uint16_t n = len - sent > chunk ? chunk : len - sent;
+    if (!sendFrame(sent == 0 ? opcode : ESP8266_WS_CONTINUATION, sent + n == len, data + sent, n)) {
+      return false;
+    }
+    sent += n;
+  } while (sent < len);
+  return true;
+}
+
+bool ESP8266WebSocket::sendFrame(uint8_t opcode, bool fin, const uint8_t *data, uint16_t len)
+{
+  uint16_t pos = 0;
+  uint8_t *mask;
+
+  if (len > ESP8266_WS_MAX_FRAME - WS_HEADER_MAX) {
+    return false;
+  }
+  m_out[pos++] = (fin ? 0x80 : 0) | opcode;
+  if (len < 126) {
+    m_out[pos++] = 0x80 | len;
+  } else {
+    m_out[pos++] = 0x80 | 126;
+    m_out[pos++] = len >> 8;
+    m_out[pos++] = len;
+  }
+  mask = m_out + pos;
+  for (uint8_t i = 0; i < 4; i++) {
+    m_out[pos++] = random(256);
+  }
+  for (uint16_t i = 0; i < len; i++) {
+    m_out[pos++] = data[i] ^ mask[i & 3];
+  }
+  return m_wifi->send(m_out, pos);
+}
+
+void ESP8266WebSocket::receive(uint32_t timeout)
+{
+  uint8_t buffer[32];
+  m_wifi->recvPieces(buffer, sizeof(buffer), sink, this, timeout);
+}
+
+void ESP8266WebSocket::sink(uint8_t *data, uint16_t len, void *context)
+{
+  ((ESP8266WebSocket *)context)->parse(data, len);
+}
+
+void ESP8266WebSocket::parse(uint8_t *data, uint16_t len)
+{
+  uint16_t i = 0;
+  uint8_t c;
+
+  /* the HTTP response: keep the status line, skip the headers up to the empty line */
+  while (m_handshake && i < len) {
+    c = data[i++];
+    if (m_statusLen < sizeof(m_status) - 1) {
+      m_status[m_statusLen++] = c;
+      m_status[m_statusLen] = '\0';
+    }
+    if (c == "\r\n\r\n"[m_matched]) {
+      m_matched++;
+    } else {
+      m_matched = c == '\r' ? 1 : 0;
+    }
+    if (m_matched == 4) {
+      m_handshake = false;
+      m_upgraded = strncmp(m_status + 8, " 101", 4) == 0;
+    }
+  }
+
+  while (i < len) {
+    if (m_state == WS_STATE_PAYLOAD) {
+      uint16_t span = len - i;
+      if (span > m_remaining) {
+        span = m_remaining;
+      }
+      for (uint16_t k = 0; m_masked && k < span; k++) {
+        data[i + k] ^= m_mask[(m_framePos + k) & 3];
+      }
+      if (m_opcode & 0x08) {
+        for (uint16_t k = 0; k < span; k++) {
+          if (m_controlLen < ESP8266_WS_MAX_CONTROL) {
+            m_control[m_controlLen++] = data[i + k];
+          } else {
+            m_controlCut = true;
+          }
+        }
+      } else if (m_callback) {
+        m_callback(m_msgOpcode, data + i, span, m_msgOffset, m_fin && span == m_remaining);
+      }
+      m_framePos += span;
+      m_remaining -= span;
+      i += span;
+      if (!(m_opcode & 0x08)) {
+        m_msgOffset += span;
+      }
+      if (m_remaining == 0) {
+        if (m_opcode & 0x08) {
+          control();
+        }
+        m_state = WS_STATE_HEADER1;
+      }
+      continue;
+    }
+
+    c = data[i++];
+    switch (m_state) {
+      case WS_STATE_HEADER1:
+        m_fin = c & 0x80;
+        m_opcode = c & 0x0F;
+        if (m_opcode == ESP8266_WS_TEXT || m_opcode == ESP8266_WS_BINARY) {
+          m_msgOpcode = m_opcode;
+          m_msgOffset = 0;
+        }
+        if (m_opcode & 0x08) {
+          m_controlLen = 0;
+          m_controlCut = false;
+        }
+        m_state = WS_STATE_HEADER2;
+        break;
+
+      case WS_STATE_HEADER2:
+        m_masked = c & 0x80;
+        m_remaining = c & 0x7F;
+        m_count = 0;
+        m_lenBytes = m_remaining == 126 ? 2 : (m_remaining == 127 ? 8 : 0);
+        if (m_lenBytes) {
+          m_remaining = 0;
+          m_state = WS_STATE_LENGTH;
+        } else {
+          m_state = m_masked ? WS_STATE_MASK : WS_STATE_PAYLOAD;
+        }
+        break;
+
+      case WS_STATE_LENGTH:
+        m_remaining = (m_remaining << 8) | c; /* 64 bit lengths keep their low 32 bits */
+        if (++m_count == m_lenBytes) {
+          m_count = 0;
+          m_state = m_masked ? WS_STATE_MASK : WS_STATE_PAYLOAD;
+        }
+        break;
+
+      default: /* WS_STATE_MASK */
+        m_mask[m_count++] = c;
+        if (m_count == 4) {
+          m_state = WS_STATE_PAYLOAD;
+        }
+        break;
+    }
+
+    if (m_state == WS_STATE_PAYLOAD) {
+      m_framePos = 0;
+      if (m_remaining == 0) {
+        if (m_opcode & 0x08) {
+          control();
+        } else if (m_callback && m_fin) {
+          m_callback(m_msgOpcode, data + i, 0, m_msgOffset, true);
+        }
+        m_state = WS_STATE_HEADER1;
+      }
+    }
+  }
+}
+
+void ESP8266WebSocket::control(void)
+{
+  switch (m_opcode) {
+    case ESP8266_WS_PING:
+      /* the pong has to carry the same data(RFC 6455 5.5.3), a cut copy is not sent */
+      if (!m_controlCut) {
+        sendFrame(ESP8266_WS_PONG, true, m_control, m_controlLen);
+      }
+      break;
+
+    case ESP8266_WS_PONG:
+      m_pingOutstanding = false;
+      break;
+
+    case ESP8266_WS_CLOSE:
+      if (m_connected) {
+        sendFrame(ESP8266_WS_CLOSE, true, m_control, m_controlLen > 2 ? 2 : m_controlLen);
+      }
+      m_connected = false;
+      m_wifi->releaseTCP();
+      break;
+
+    default:
+      break;
+  }
+}
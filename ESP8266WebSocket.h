@@ -0,0 +1,182 @@
+/**
+ * @file ESP8266WebSocket.h
+ * @brief The definition of class ESP8266WebSocket.
+ *
+ * @par Copyright:
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version. \n\n
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ESP8266WEBSOCKET_H__
+#define __ESP8266WEBSOCKET_H__
+
+#include "ESP8266.h"
+
+/* Size of the buffer outgoing frames are built in, longer messages are fragmented(125 byte payloads) */
+#define ESP8266_WS_MAX_FRAME    133
+
+/* Longest control payload kept, 125 in RFC 6455. A longer ping gets no pong, as the echo would be cut */
+#define ESP8266_WS_MAX_CONTROL  125
+
+/* Frame opcodes */
+#define ESP8266_WS_CONTINUATION 0x0
+#define ESP8266_WS_TEXT         0x1
+#define ESP8266_WS_BINARY       0x2
+#define ESP8266_WS_CLOSE        0x8
+#define ESP8266_WS_PING         0x9
+#define ESP8266_WS_PONG         0xA
+
+/**
+ * Called for incoming data messages, once per received piece.
+ *
+ * Fragmented messages arrive as consecutive pieces of one message: nothing is buffered.
+ *
+ * @param opcode - ESP8266_WS_TEXT or ESP8266_WS_BINARY, the type of the whole message.
+ * @param data - this piece of the message.
+ * @param len - the length of this piece.
+ * @param offset - the position of this piece in the message.
+ * @param last - true for the last piece of the message.
+ */
+typedef void (*ESP8266WebSocketCallback)(uint8_t opcode, const uint8_t *data, uint16_t len,
+                                         uint32_t offset, bool last);
+
+/**
+ * WebSocket(RFC 6455) client over the single connection TCP of ESP8266.
+ */
+class ESP8266WebSocket {
+ public:
+    /*
+     * Constuctor.
+     *
+     * @param wifi - the ESP8266 to connect through(single connection mode).
+     */
+    ESP8266WebSocket(ESP8266 &wifi);
+
+    /**
+     * Open a WebSocket by the HTTP upgrade handshake.
+     *
+     * Passive receive mode is enabled, so frames are pulled in small pieces. Firmware without
+     * AT+CIPRECVMODE is not supported.
+     *
+     * @param host - the IP or domain name of the server.
+     * @param port - the port number of the server(default: 80).
+     * @param path - the resource to open(default: "/").
+     * @param timeout - the time waiting for the handshake response by ms(default: 5000).
+     * @retval true - the server answered "101 Switching Protocols".
+     * @retval false - failure, or passive receive mode could not be enabled.
+     * @note Sec-WebSocket-Accept is not verified: that would take SHA-1 on the board.
+     */
+    bool connect(String host, uint32_t port = 80, String path = "/", uint32_t timeout = 5000);
+
+    /**
+     * Send a close frame and close the connection.
+     */
+    void disconnect(void);
+
+    /**
+     * Whether the WebSocket is open.
+     */
+    bool connected(void);
+
+    /**
+     * Send a text message, fragmented into frames of at most ESP8266_WS_MAX_FRAME bytes.
+     */
+    bool sendText(const char *text);
+
+    /**
+     * Send a binary message, fragmented into frames of at most ESP8266_WS_MAX_FRAME bytes.
+     */
+    bool sendBinary(const uint8_t *data, uint32_t len);
+
+    /**
+     * Send a ping. Its pong is checked by loop.
+     */
+    bool ping(void);
+
+    /**
+     * Ping the server every interval ms from loop, and close if no pong came back in time.
+     *
+     * @param interval - the ping interval by ms(0 - disable).
+     */
+    void setPingInterval(uint32_t interval);
+
+    /**
+     * Set the callback of incoming messages.
+     */
+    void setCallback(ESP8266WebSocketCallback callback);
+
+    /**
+     * Receive and handle incoming frames and keep the connection alive. Call it from loop().
+     */
+    void loop(void);
+
+ private:
+    /*
+     * Send a message of opcode split into frames.
+     */
+    bool sendMessage(uint8_t opcode, const uint8_t *data, uint32_t len);
+
+    /*
+     * Send one masked frame.
+     */
+    bool sendFrame(uint8_t opcode, bool fin, const uint8_t *data, uint16_t len);
+
+    /*
+     * Feed received bytes to the handshake or frame parser. Data frames are unmasked in place.
+     */
+    void parse(uint8_t *data, uint16_t len);
+
+    /*
+     * Handle a control frame which was received completely.
+     */
+    void control(void);
+
+    /*
+     * Receive pending data for up to timeout ms.
+     */
+    void receive(uint32_t timeout);
+
+    /*
+     * Pass a piece pulled by receive to the parser of the socket in context.
+     */
+    static void sink(uint8_t *data, uint16_t len, void *context);
+
+    ESP8266 *m_wifi;
+    ESP8266WebSocketCallback m_callback;
+    bool m_connected;
+    bool m_handshake;           /* the HTTP response headers are still being read */
+    bool m_upgraded;            /* the status line said 101 */
+    bool m_pingOutstanding;
+    uint32_t m_pingInterval;
+    unsigned long m_pingSent;
+    uint8_t m_out[ESP8266_WS_MAX_FRAME];
+
+    /* parser state */
+    uint8_t m_state;
+    uint8_t m_matched;          /* bytes of "\r\n\r\n" matched */
+    uint8_t m_statusLen;
+    char m_status[13];          /* "HTTP/1.1 101" */
+    uint8_t m_opcode;           /* the opcode of the current frame */
+    uint8_t m_msgOpcode;        /* the opcode of the current data message */
+    bool m_fin;
+    bool m_masked;
+    uint8_t m_mask[4];
+    uint8_t m_count;            /* bytes of the extended length or mask read */
+    uint8_t m_lenBytes;
+    uint32_t m_remaining;       /* payload bytes of the frame not parsed yet */
+    uint32_t m_framePos;
+    uint32_t m_msgOffset;
+    uint8_t m_control[ESP8266_WS_MAX_CONTROL];
+    uint8_t m_controlLen;
+    bool m_controlCut;          /* the control payload did not fit in m_control */
+};
+
+#endif /* #ifndef __ESP8266WEBSOCKET_H__ */
@@ -0,0 +1,348 @@
+/*
+   Runs ESP8266::download on a PC: a simulated ESP8266 serves a local file over HTTP in +IPD
+   frames, and the sink writes what it gets to another file, like a sketch writes to an SD card.
+
+   The library runs on a virtual clock. The response comes back at the UART baud rate with a
+   network gap between frames, through a 64 byte SoftwareSerial RX buffer which overflows like the
+   real one while the sink is busy. The connection can be dropped every few KB to try the resume,
+   and the server can ignore Range to try the skipping. At the end the copy is compared with the
+   file and the CRC-32 of the library with one computed here.
+
+   Build(from this folder, with the Arduino shim of trace_replay):
+     g++ -O2 -fpermissive -I../trace_replay -I../.. -o download_test download_test.cpp \
+         ../trace_replay/arduino_shim.cpp ../../ESP8266.cpp
+
+   Usage:
+     download_test [-b baud] [-f frame] [-g gap] [-d drop] [-r] [-w sink] [-s size] file copy
+
+   baud: the UART rate(default 9600). frame: the most bytes per +IPD frame(default 1460).
+   gap: ms between frames(default 20). drop: close the connection after this many bytes of each
+   body(default 0, never). -r: answer every request with the whole file. sink: ms the sink takes
+   per call(default 10). size: the download buffer, two halves of size / 2(default 512).
+*/
+#include <stdio.h>
+#include <deque>
+#include <vector>
+#include "Arduino.h"
+#include "SoftwareSerial.h"
+#include "ESP8266.h"
+
+/* Time one millis()/micros() call takes, so wait loops always make progress */
+#define CLOCK_STEP_US   2
+
+/* Give up after this much virtual time */
+#define LIMIT_US        3600000000ULL
+
+struct Scheduled {
+  uint64_t time;
+  uint8_t c;
+};
+
+static std::vector<uint8_t> g_file;
+static FILE *g_copy = NULL;
+static long g_baud = 9600;
+static uint32_t g_frame = 1460;
+static uint32_t g_gap = 20;
+static uint32_t g_drop = 0;
+static bool g_ignoreRange = false;
+static uint32_t g_sinkMs = 10;
+
+static uint64_t g_now = 0;
+static uint64_t g_txFree = 0;               /* when the ESP8266 can send its next byte */
+static std::deque<Scheduled> g_pending;     /* bytes on their way, in time order */
+static std::deque<uint8_t> g_fifo;          /* the SoftwareSerial RX buffer */
+static bool g_overflow = false;
+static unsigned long g_overflows = 0;
+static std::string g_line;                  /* the command being received */
+static uint32_t g_sendLeft = 0;             /* payload bytes of AT+CIPSEND still to come */
+static std::string g_request;
+static bool g_connected = false;
+static unsigned long g_requests = 0;
+
+static void advance(uint64_t us)
+{
+  g_now += us;
+  if (g_now > LIMIT_US) {
+    printf("the download did not end within %llu s\n", LIMIT_US / 1000000);
+    exit(1);
+  }
+}
+
+static void deliver(void)
+{
+  while (!g_pending.empty() && g_pending.front().time <= g_now) {
+    if (g_fifo.size() < _SS_MAX_RX_BUFF) {
+      g_fifo.push_back(g_pending.front().c);
+    } else {
+      g_overflow = true;
+      g_overflows++;
+    }
+    g_pending.pop_front();
+  }
+}
+
+/* The ESP8266 sends s delay_ms after what it is sending already */
+static void respond(const std::string &s, uint32_t delay_ms = 1)
+{
+  uint64_t time = (g_txFree > g_now ? g_txFree : g_now) + delay_ms * 1000ULL;
+  for (size_t i = 0; i < s.size(); i++) {
+    Scheduled b = {time, (uint8_t)s[i]};
+    g_pending.push_back(b);
+    time += 10000000ULL / g_baud;
+  }
+  g_txFree = time;
+}
+
+/* The HTTP server: answer the request in frames, or up to the drop and then close */
+static void serve(void)
+{
+  uint32_t from = 0;
+  size_t range = g_request.find("Range: bytes=");
+  std::string head;
+  std::string stream;
+  char line[96];
+
+  g_requests++;
+  if (range != std::string::npos && !g_ignoreRange) {
+    from = strtoul(g_request.c_str() + range + 13, NULL, 10);
+  }
+  if (from > g_file.size()) {
+    head = "HTTP/1.0 416 Range Not Satisfiable\r\n\r\n";
+  } else if (from > 0) {
+    snprintf(line, sizeof(line), "HTTP/1.0 206 Partial Content\r\nContent-Range: bytes %u-%u/%u\r\n",
+             from, (unsigned)g_file.size() - 1, (unsigned)g_file.size());
+    head = line;
+  } else {
+    head = "HTTP/1.0 200 OK\r\n";
+  }
+  if (from <= g_file.size()) {
+    snprintf(line, sizeof(line), "Content-Type: application/octet-stream\r\nContent-Length: %u\r\n\r\n",
+             (unsigned)(g_file.size() - from));
+    head += line;
+  }
+
+  stream = head;
+  if (from <= g_file.size()) {
+    uint32_t len = g_file.size() - from;
+    if (g_drop > 0 && len > g_drop) {
+      len = g_drop;
+    }
+    stream.append((const char *)&g_file[from], len);
+  }
+  for (size_t i = 0; i < stream.size(); i += g_frame) {
+    size_t n = stream.size() - i < g_frame ? stream.size() - i : g_frame;
+    snprintf(line, sizeof(line), "\r\n+IPD,%u:", (unsigned)n);
+    respond(line + stream.substr(i, n), g_gap);
+  }
+  respond("CLOSED\r\n", g_gap);
+}
+
+static void command(const std::string &cmd)
+{
+  if (cmd.compare(0, 11, "AT+CIPSTART") == 0) {
+    g_connected = true;
+    respond("CONNECT\r\n\r\nOK\r\n", 50);
+  } else if (cmd.compare(0, 11, "AT+CIPSEND=") == 0) {
+    g_sendLeft = atoi(cmd.c_str() + 11);
+    g_request.clear();
+    respond("\r\nOK\r\n> ");
+  } else if (cmd.compare(0, 11, "AT+CIPCLOSE") == 0) {
+    /* open until its "CLOSED" went out; what the UART did not carry yet is gone */
+    deliver();
+    g_connected = g_connected && !g_pending.empty();
+    g_pending.clear();
+    g_txFree = g_now;
+    respond(g_connected ? "CLOSED\r\n\r\nOK\r\n" : "\r\nERROR\r\n");
+    g_connected = false;
+  } else {
+    respond("\r\nOK\r\n");
+  }
+}
+
+unsigned long millis(void)
+{
+  advance(CLOCK_STEP_US);
+  return g_now / 1000;
+}
+
+unsigned long micros(void)
+{
+  advance(CLOCK_STEP_US);
+  return g_now;
+}
+
+void delay(unsigned long ms)
+{
+  advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  advance(us);
+}
+
+void yield(void)
+{
+  advance(CLOCK_STEP_US);
+}
+
+SoftwareSerial::SoftwareSerial(uint8_t, uint8_t, bool)
+{
+
+}
+
+void SoftwareSerial::begin(long baud)
+{
+  g_baud = baud;
+}
+
+bool SoftwareSerial::overflow(void)
+{
+  bool ret = g_overflow;
+  g_overflow = false;
+  return ret;
+}
+
+int SoftwareSerial::available(void)
+{
+  advance(1);
+  deliver();
+  return g_fifo.size();
+}
+
+int SoftwareSerial::read(void)
+{
+  int c;
+  deliver();
+  if (g_fifo.empty()) {
+    return -1;
+  }
+  c = g_fifo.front();
+  g_fifo.pop_front();
+  return c;
+}
+
+int SoftwareSerial::peek(void)
+{
+  deliver();
+  return g_fifo.empty() ? -1 : g_fifo.front();
+}
+
+size_t SoftwareSerial::write(uint8_t c)
+{
+  /* SoftwareSerial sends with interrupts off: 10 bits per byte */
+  advance(10000000ULL / g_baud);
+  if (g_sendLeft > 0) {
+    g_request += (char)c;
+    if (--g_sendLeft == 0) {
+      respond("\r\nRecv " + std::to_string(g_request.size()) + " bytes\r\n\r\nSEND OK\r\n");
+      if (g_connected) {
+        serve();
+      }
+    }
+    return 1;
+  }
+  g_line += (char)c;
+  if (g_line.size() >= 2 && g_line.compare(g_line.size() - 2, 2, "\r\n") == 0) {
+    command(g_line);
+    g_line.clear();
+  }
+  return 1;
+}
+
+/* The file backed sink: write at the offset, then take as long as an SD card */
+static bool fileSink(const uint8_t *data, uint16_t len, uint32_t offset, void *context)
+{
+  FILE *f = (FILE *)context;
+  if (fseek(f, offset, SEEK_SET) != 0 || fwrite(data, 1, len, f) != len) {
+    return false;
+  }
+  delay(g_sinkMs);
+  return true;
+}
+
+static uint32_t crc32(const std::vector<uint8_t> &data)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < data.size(); i++) {
+    crc ^= data[i];
+    for (int k = 0; k < 8; k++) {
+      crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+  }
+  return ~crc;
+}
+
+int main(int argc, char **argv)
+{
+  const char *in = NULL;
+  const char *out = NULL;
+  uint16_t size = 512;
+  std::vector<uint8_t> copy;
+  ESP8266Download state;
+  FILE *f;
+  bool ok;
+  int c;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      g_baud = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      g_frame = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+      g_gap = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      g_drop = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0) {
+      g_ignoreRange = true;
+    } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      g_sinkMs = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      size = atol(argv[++i]);
+    } else if (in == NULL) {
+      in = argv[i];
+    } else {
+      out = argv[i];
+    }
+  }
+  if (out == NULL || g_baud <= 0 || g_frame == 0) {
+    fprintf(stderr, "usage: %s [-b baud] [-f frame] [-g gap] [-d drop] [-r] [-w sink] [-s size] file copy\n",
+            argv[0]);
+    return 2;
+  }
+  if ((f = fopen(in, "rb")) == NULL) {
+    perror(in);
+    return 1;
+  }
+  while ((c = fgetc(f)) != EOF) {
+    g_file.push_back(c);
+  }
+  fclose(f);
+  if ((g_copy = fopen(out, "w+b")) == NULL) {
+    perror(out);
+    return 1;
+  }
+
+  SoftwareSerial uart(2, 3);
+  ESP8266 wifi(uart);
+  std::vector<uint8_t> buffer(size);
+  uart.begin(g_baud);
+  memset(&state, 0, sizeof(state));
+  ok = wifi.download("192.168.1.10", 80, "/file.bin", &buffer[0], size, fileSink, g_copy, &state);
+
+  fflush(g_copy);
+  rewind(g_copy);
+  while ((c = fgetc(g_copy)) != EOF) {
+    copy.push_back(c);
+  }
+  fclose(g_copy);
+
+  printf("download %s after %.1f s: %u of %u bytes, HTTP %u\n", ok ? "done" : "FAILED", g_now / 1e6,
+         state.offset, state.total, state.status);
+  printf("%u connections(%lu requests), %u frames, %u swaps, %u stalls, %u ms in the sink\n",
+         state.connections, g_requests, state.frames, state.swaps, state.stalls, state.sink_time);
+  printf("%lu bytes lost by RX overflows, %u connections given up for them\n", g_overflows, state.overruns);
+  printf("CRC-32 %08X, of the file %08X, the copy %s\n", state.crc, crc32(g_file),
+         copy == g_file ? "is the same" : "DIFFERS");
+  return ok && copy == g_file && state.crc == crc32(g_file) ? 0 : 1;
+}
@@ -0,0 +1,384 @@
+/*
+   Runs ESP8266MQTT on a PC: a simulated ESP8266 in passive receive mode carries the session to a
+   broker stand-in, which answers CONNECT and SUBSCRIBE and then publishes a local file as the
+   payload of a few messages. The callback puts the pieces together and they are compared with the
+   file.
+
+   The library runs on a virtual clock. The broker data reaches the module in TCP segments with a
+   network gap between them; the module holds up to a TCP window of it and tells "+IPD,<len>" like
+   the real firmware does in passive mode, and the library pulls it by AT+CIPRECVDATA at the UART
+   baud rate, through a 64 byte SoftwareSerial RX buffer. -a plays firmware without AT+CIPRECVMODE:
+   connect has to refuse, as in active mode the frames would be cut to the receive buffer.
+
+   Build(from this folder, with the Arduino shim of trace_replay):
+     g++ -O2 -fpermissive -I../trace_replay -I../.. -o mqtt_test mqtt_test.cpp \
+         ../trace_replay/arduino_shim.cpp ../../ESP8266.cpp ../../ESP8266MQTT.cpp
+
+   Usage:
+     mqtt_test [-b baud] [-f segment] [-g gap] [-n count] [-a] file
+
+   baud: the UART rate(default 9600). segment: the most bytes per TCP segment(default 1460).
+   gap: ms between segments(default 20). count: messages published with the file(default 3).
+*/
+#include <stdio.h>
+#include <deque>
+#include <vector>
+#include "Arduino.h"
+#include "SoftwareSerial.h"
+#include "ESP8266.h"
+#include "ESP8266MQTT.h"
+
+/* Time one millis()/micros() call takes, so wait loops always make progress */
+#define CLOCK_STEP_US   2
+
+/* Give up after this much virtual time */
+#define LIMIT_US        600000000ULL
+
+/* Data the module holds in passive mode before the TCP window closes */
+#define WINDOW          5840
+
+#define TOPIC           "test/file"
+
+struct Scheduled {
+  uint64_t time;
+  uint8_t c;
+};
+
+struct Segment {
+  uint64_t time;
+  std::string data;
+};
+
+static std::vector<uint8_t> g_file;
+static long g_baud = 9600;
+static uint32_t g_segment = 1460;
+static uint32_t g_gap = 20;
+static uint32_t g_count = 3;
+static bool g_noPassive = false;
+
+static uint64_t g_now = 0;
+static uint64_t g_txFree = 0;               /* when the ESP8266 can send its next byte */
+static std::deque<Scheduled> g_pending;     /* bytes on their way to the UART, in time order */
+static std::deque<uint8_t> g_fifo;          /* the SoftwareSerial RX buffer */
+static bool g_overflow = false;
+static unsigned long g_overflows = 0;
+static std::string g_line;                  /* the command being received */
+static uint32_t g_sendLeft = 0;             /* payload bytes of AT+CIPSEND still to come */
+static std::string g_request;
+static bool g_passive = false;
+static uint64_t g_netFree = 0;              /* when the broker can send its next segment */
+static std::deque<Segment> g_network;       /* segments on their way from the broker */
+static std::string g_held;                  /* data held by the module in passive mode */
+static std::string g_client;                /* bytes from the client not parsed yet */
+static unsigned long g_pulls = 0;
+
+/* what the callback got */
+static std::vector<uint8_t> g_message;
+static uint32_t g_received = 0;
+static uint32_t g_good = 0;
+static uint32_t g_pieces = 0;
+static bool g_order = true;
+
+static void advance(uint64_t us)
+{
+  g_now += us;
+  if (g_now > LIMIT_US) {
+    printf("the messages did not come within %llu s\n", LIMIT_US / 1000000);
+    exit(1);
+  }
+}
+
+/* The ESP8266 sends s delay_ms after what it is sending already */
+static void respond(const std::string &s, uint32_t delay_ms = 1)
+{
+  uint64_t time = (g_txFree > g_now ? g_txFree : g_now) + delay_ms * 1000ULL;
+  for (size_t i = 0; i < s.size(); i++) {
+    Scheduled b = {time, (uint8_t)s[i]};
+    g_pending.push_back(b);
+    time += 10000000ULL / g_baud;
+  }
+  g_txFree = time;
+}
+
+static void deliver(void)
+{
+  char line[32];
+
+  /* the module keeps what the network brought and tells how much, the rest waits for the window */
+  while (!g_network.empty() && g_network.front().time <= g_now
+         && g_held.size() + g_network.front().data.size() <= WINDOW) {
+    g_held += g_network.front().data;
+    snprintf(line, sizeof(line), "\r\n+IPD,%u\r\n", (unsigned)g_network.front().data.size());
+    respond(line, 0);
+    g_network.pop_front();
+  }
+  while (!g_pending.empty() && g_pending.front().time <= g_now) {
+    if (g_fifo.size() < _SS_MAX_RX_BUFF) {
+      g_fifo.push_back(g_pending.front().c);
+    } else {
+      g_overflow = true;
+      g_overflows++;
+    }
+    g_pending.pop_front();
+  }
+}
+
+/* The broker sends s in segments */
+static void publish(const std::string &s)
+{
+  for (size_t i = 0; i < s.size(); i += g_segment) {
+    g_netFree = (g_netFree > g_now ? g_netFree : g_now) + g_gap * 1000ULL;
+    Segment seg = {g_netFree, s.substr(i, g_segment)};
+    g_network.push_back(seg);
+  }
+}
+
+static std::string packet(uint8_t type, const std::string &body)
+{
+  std::string p(1, (char)type);
+  uint32_t remaining = body.size();
+  do {
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    p += (char)(remaining > 0 ? digit | 0x80 : digit);
+  } while (remaining > 0);
+  return p + body;
+}
+
+/* The broker stand-in: answer every complete packet of the client */
+static void broker(void)
+{
+  while (g_client.size() >= 2) {
+    uint32_t len = 0;
+    uint8_t shift = 0;
+    size_t pos = 1;
+    while (pos < g_client.size() && (g_client[pos] & 0x80)) {
+      len |= (uint32_t)(g_client[pos++] & 0x7F) << shift;
+      shift += 7;
+    }
+    if (pos >= g_client.size()) {
+      return;
+    }
+    len |= (uint32_t)(g_client[pos++] & 0x7F) << shift;
+    if (g_client.size() < pos + len) {
+      return;
+    }
+    uint8_t type = g_client[0];
+    std::string body = g_client.substr(pos, len);
+    g_client.erase(0, pos + len);
+
+    if (type == 0x10) {
+      publish(packet(0x20, std::string("\x00\x00", 2)));
+    } else if (type == 0x82) {
+      publish(packet(0x90, body.substr(0, 2) + std::string("\x00", 1)));
+      std::string head = std::string("\x00", 1) + (char)(sizeof(TOPIC) - 1) + TOPIC;
+      std::string file(g_file.begin(), g_file.end());
+      for (uint32_t i = 0; i < g_count; i++) {
+        publish(packet(0x30, head + file));
+      }
+    } else if (type == 0xC0) {
+      publish(packet(0xD0, ""));
+    }
+  }
+}
+
+static void command(const std::string &cmd)
+{
+  char line[48];
+
+  if (cmd.compare(0, 16, "AT+CIPRECVMODE=1") == 0) {
+    g_passive = !g_noPassive;
+    respond(g_passive ? "\r\nOK\r\n" : "\r\nERROR\r\n");
+  } else if (cmd.compare(0, 11, "AT+CIPSTART") == 0) {
+    respond("CONNECT\r\n\r\nOK\r\n", 50);
+  } else if (cmd.compare(0, 11, "AT+CIPSEND=") == 0) {
+    g_sendLeft = atoi(cmd.c_str() + 11);
+    g_request.clear();
+    respond("\r\nOK\r\n> ");
+  } else if (cmd.compare(0, 15, "AT+CIPRECVDATA=") == 0) {
+    size_t n = atoi(cmd.c_str() + 15);
+    n = n < g_held.size() ? n : g_held.size();
+    snprintf(line, sizeof(line), "+CIPRECVDATA,%u:", (unsigned)n);
+    respond(line + g_held.substr(0, n) + "\r\nOK\r\n");
+    g_held.erase(0, n);
+    g_pulls++;
+  } else if (cmd.compare(0, 14, "AT+CIPRECVLEN?") == 0) {
+    snprintf(line, sizeof(line), "+CIPRECVLEN:%u,0,0,0,0\r\n\r\nOK\r\n", (unsigned)g_held.size());
+    respond(line);
+  } else if (cmd.compare(0, 11, "AT+CIPCLOSE") == 0) {
+    respond("CLOSED\r\n\r\nOK\r\n");
+  } else {
+    respond("\r\nOK\r\n");
+  }
+}
+
+unsigned long millis(void)
+{
+  advance(CLOCK_STEP_US);
+  return g_now / 1000;
+}
+
+unsigned long micros(void)
+{
+  advance(CLOCK_STEP_US);
+  return g_now;
+}
+
+void delay(unsigned long ms)
+{
+  advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  advance(us);
+}
+
+void yield(void)
+{
+  advance(CLOCK_STEP_US);
+}
+
+SoftwareSerial::SoftwareSerial(uint8_t, uint8_t, bool)
+{
+
+}
+
+void SoftwareSerial::begin(long baud)
+{
+  g_baud = baud;
+}
+
+bool SoftwareSerial::overflow(void)
+{
+  bool ret = g_overflow;
+  g_overflow = false;
+  return ret;
+}
+
+int SoftwareSerial::available(void)
+{
+  advance(1);
+  deliver();
+  return g_fifo.size();
+}
+
+int SoftwareSerial::read(void)
+{
+  int c;
+  deliver();
+  if (g_fifo.empty()) {
+    return -1;
+  }
+  c = g_fifo.front();
+  g_fifo.pop_front();
+  return c;
+}
+
+int SoftwareSerial::peek(void)
+{
+  deliver();
+  return g_fifo.empty() ? -1 : g_fifo.front();
+}
+
+size_t SoftwareSerial::write(uint8_t c)
+{
+  /* SoftwareSerial sends with interrupts off: 10 bits per byte */
+  advance(10000000ULL / g_baud);
+  if (g_sendLeft > 0) {
+    g_request += (char)c;
+    if (--g_sendLeft == 0) {
+      respond("\r\nRecv " + std::to_string(g_request.size()) + " bytes\r\n\r\nSEND OK\r\n");
+      g_client += g_request;
+      broker();
+    }
+    return 1;
+  }
+  g_line += (char)c;
+  if (g_line.size() >= 2 && g_line.compare(g_line.size() - 2, 2, "\r\n") == 0) {
+    command(g_line);
+    g_line.clear();
+  }
+  return 1;
+}
+
+/* Put the pieces of each message together, they have to come in order */
+static void onPublish(const char *topic, const uint8_t *payload, uint16_t len, uint32_t offset, uint32_t total)
+{
+  g_pieces++;
+  if (strcmp(topic, TOPIC) != 0 || offset != g_message.size() || total != g_file.size()) {
+    g_order = false;
+  }
+  g_message.insert(g_message.end(), payload, payload + len);
+  if (offset + len >= total) {
+    g_received++;
+    if (g_message == g_file) {
+      g_good++;
+    }
+    g_message.clear();
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *in = NULL;
+  bool ok;
+  int c;
+  FILE *f;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      g_baud = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      g_segment = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+      g_gap = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      g_count = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-a") == 0) {
+      g_noPassive = true;
+    } else {
+      in = argv[i];
+    }
+  }
+  if (in == NULL || g_baud <= 0 || g_segment == 0) {
+    fprintf(stderr, "usage: %s [-b baud] [-f segment] [-g gap] [-n count] [-a] file\n", argv[0]);
+    return 2;
+  }
+  if ((f = fopen(in, "rb")) == NULL) {
+    perror(in);
+    return 1;
+  }
+  while ((c = fgetc(f)) != EOF) {
+    g_file.push_back(c);
+  }
+  fclose(f);
+
+  SoftwareSerial uart(2, 3);
+  ESP8266 wifi(uart);
+  ESP8266MQTT mqtt(wifi);
+  uart.begin(g_baud);
+  mqtt.setCallback(onPublish);
+  ok = mqtt.connect("192.168.1.10", 1883, "mqtt_test");
+  if (g_noPassive) {
+    printf("connect %s without passive receive mode\n", ok ? "ACCEPTED" : "refused");
+    return ok ? 1 : 0;
+  }
+  if (!ok || !mqtt.subscribe("test/#")) {
+    printf("connect or subscribe FAILED\n");
+    return 1;
+  }
+  while (g_received < g_count && mqtt.connected()) {
+    mqtt.loop();
+  }
+  if (!mqtt.connected()) {
+    printf("the client dropped the connection after %.1f s\n", g_now / 1e6);
+  }
+  mqtt.disconnect();
+
+  printf("%u of %u messages of %u bytes after %.1f s, %u the same as the file\n", g_received, g_count,
+         (unsigned)g_file.size(), g_now / 1e6, g_good);
+  printf("%u pieces to the callback%s, %lu AT+CIPRECVDATA, %lu bytes lost by RX overflows\n", g_pieces,
+         g_order ? " in order" : " OUT OF ORDER", g_pulls, g_overflows);
+  return g_good == g_count && g_order ? 0 : 1;
+}
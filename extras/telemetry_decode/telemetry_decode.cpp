@@ -0,0 +1,100 @@
+/*
+   Host side decoder of the batches built by ESP8266TelemetryEncoder.
+
+   Build:
+     g++ -O2 -I../.. -o telemetry_decode telemetry_decode.cpp ../../ESP8266Telemetry.cpp
+
+   Usage:
+     telemetry_decode <schema> [tag] < batches.txt
+
+   schema has one letter per field: 'a' absolute, 'd' delta, 't' delta of delta(timestamps).
+   Each input line is one batch in hex, as logged by the server or printed by the
+   TelemetryBenchmark example. The records are written as CSV, one line per record.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "ESP8266Telemetry.h"
+
+static int hexval(int c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+int main(int argc, char **argv)
+{
+  ESP8266FieldEncoding fields[ESP8266_TELEMETRY_MAX_FIELDS];
+  uint8_t count = 0;
+  uint8_t tag = 0;
+  static char line[65536];
+  static uint8_t batch[sizeof(line) / 2];
+  unsigned long lineno = 0;
+  int status = 0;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <schema: a|d|t per field> [tag] < batches.txt\n", argv[0]);
+    return 2;
+  }
+  for (const char *p = argv[1]; *p; p++) {
+    if (count == ESP8266_TELEMETRY_MAX_FIELDS) {
+      fprintf(stderr, "at most %d fields\n", ESP8266_TELEMETRY_MAX_FIELDS);
+      return 2;
+    }
+    switch (*p) {
+      case 'a': fields[count++] = ESP8266_FIELD_ABSOLUTE; break;
+      case 'd': fields[count++] = ESP8266_FIELD_DELTA; break;
+      case 't': fields[count++] = ESP8266_FIELD_DELTA2; break;
+      default:
+        fprintf(stderr, "unknown field encoding '%c'\n", *p);
+        return 2;
+    }
+  }
+  if (argc > 2) {
+    tag = (uint8_t)strtoul(argv[2], NULL, 0);
+  }
+
+  ESP8266TelemetryDecoder decoder(fields, count, tag);
+  while (fgets(line, sizeof(line), stdin)) {
+    uint16_t len = 0;
+    int high = -1;
+    int32_t values[ESP8266_TELEMETRY_MAX_FIELDS];
+
+    lineno++;
+    for (const char *p = line; *p; p++) {
+      int v = hexval(*p);
+      if (v < 0) {
+        continue;
+      }
+      if (high < 0) {
+        high = v;
+      } else {
+        batch[len++] = (uint8_t)(high << 4 | v);
+        high = -1;
+      }
+    }
+    if (len == 0) {
+      continue;
+    }
+    if (!decoder.begin(batch, len)) {
+      fprintf(stderr, "line %lu: schema tag 0x%02x, expected 0x%02x\n", lineno, batch[0], tag);
+      status = 1;
+      continue;
+    }
+    while (decoder.next(values)) {
+      for (uint8_t i = 0; i < count; i++) {
+        printf(i ? ",%ld" : "%ld", (long)values[i]);
+      }
+      printf("\n");
+    }
+  }
+  return status;
+}
@@ -0,0 +1,179 @@
+/*
+   The part of the Arduino API the ESP8266 library and simple sketches use, for running them
+   on a PC under trace_replay. Time is virtual: see arduino_shim.cpp.
+*/
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+class String {
+ public:
+  String() {}
+  String(const char *s) : m_s(s ? s : "") {}
+  String(const __FlashStringHelper *s) : m_s((const char *)s) {}
+  explicit String(char c) : m_s(1, c) {}
+  explicit String(int v, unsigned char base = 10) : m_s(number(v, base)) {}
+  explicit String(unsigned int v, unsigned char base = 10) : m_s(number(v, base)) {}
+  explicit String(long v, unsigned char base = 10) : m_s(number(v, base)) {}
+  explicit String(unsigned long v, unsigned char base = 10) : m_s(number(v, base)) {}
+
+  String &operator+=(const String &s) { m_s += s.m_s; return *this; }
+  String &operator+=(const char *s) { m_s += s; return *this; }
+  String &operator+=(char c) { m_s += c; return *this; }
+  String &operator+=(int v) { m_s += number(v, 10); return *this; }
+  String &operator+=(unsigned int v) { m_s += number(v, 10); return *this; }
+  String &operator+=(long v) { m_s += number(v, 10); return *this; }
+  String &operator+=(unsigned long v) { m_s += number(v, 10); return *this; }
+  unsigned char concat(const String &s) { m_s += s.m_s; return 1; }
+  unsigned char concat(char c) { m_s += c; return 1; }
+  unsigned char reserve(unsigned int n) { m_s.reserve(n); return 1; }
+
+  unsigned int length(void) const { return m_s.size(); }
+  const char *c_str(void) const { return m_s.c_str(); }
+  char charAt(unsigned int i) const { return i < m_s.size() ? m_s[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  bool equals(const String &s) const { return m_s == s.m_s; }
+  bool operator==(const String &s) const { return m_s == s.m_s; }
+  bool operator==(const char *s) const { return m_s == s; }
+  bool operator!=(const String &s) const { return m_s != s.m_s; }
+
+  int indexOf(char c, unsigned int from = 0) const { return found(m_s.find(c, from)); }
+  int indexOf(const String &s, unsigned int from = 0) const { return found(m_s.find(s.m_s, from)); }
+  int lastIndexOf(char c) const { return found(m_s.rfind(c)); }
+  int lastIndexOf(const String &s) const { return found(m_s.rfind(s.m_s)); }
+  bool startsWith(const String &s) const { return m_s.compare(0, s.m_s.size(), s.m_s) == 0; }
+  bool endsWith(const String &s) const
+  {
+    return m_s.size() >= s.m_s.size() && m_s.compare(m_s.size() - s.m_s.size(), s.m_s.size(), s.m_s) == 0;
+  }
+  String substring(unsigned int from) const { return substring(from, m_s.size()); }
+  String substring(unsigned int from, unsigned int to) const;
+  long toInt(void) const { return atol(m_s.c_str()); }
+  void trim(void);
+  void remove(unsigned int index) { if (index < m_s.size()) m_s.erase(index); }
+  void remove(unsigned int index, unsigned int count) { if (index < m_s.size()) m_s.erase(index, count); }
+  void toCharArray(char *buf, unsigned int size, unsigned int index = 0) const;
+  void getBytes(unsigned char *buf, unsigned int size, unsigned int index = 0) const
+  {
+    toCharArray((char *)buf, size, index);
+  }
+
+ private:
+  static std::string number(long v, unsigned char base);
+  static std::string number(unsigned long v, unsigned char base);
+  static std::string number(int v, unsigned char base) { return number((long)v, base); }
+  static std::string number(unsigned int v, unsigned char base) { return number((unsigned long)v, base); }
+  static int found(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+  std::string m_s;
+};
+
+template <class T> String operator+(const String &a, const T &b)
+{
+  String r(a);
+  r += b;
+  return r;
+}
+inline String operator+(const char *a, const String &b)
+{
+  String r(a);
+  r += b;
+  return r;
+}
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size);
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t write(const char *buf, size_t size) { return write((const uint8_t *)buf, size); }
+  virtual void flush(void) {}
+
+  size_t print(const __FlashStringHelper *s) { return write((const char *)s); }
+  size_t print(const String &s) { return write(s.c_str()); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC) { return print(String(v, base)); }
+  size_t print(unsigned long v, int base = DEC) { return print(String(v, base)); }
+  size_t print(double v, int digits = 2);
+
+  size_t println(void) { return write("\r\n"); }
+  template <class T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+  template <class T> size_t println(const T &v, int format) { size_t n = print(v, format); return n + println(); }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available(void) = 0;
+  virtual int read(void) = 0;
+  virtual int peek(void) = 0;
+  void setTimeout(unsigned long timeout) { m_timeout = timeout; }
+  String readString(void);
+  String readStringUntil(char terminator);
+  size_t readBytes(char *buf, size_t size);
+  size_t readBytes(uint8_t *buf, size_t size) { return readBytes((char *)buf, size); }
+
+ protected:
+  int timedRead(void);
+  unsigned long m_timeout = 1000;
+};
+
+/* Serial of the sketch: written to stderr, never receives */
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  void begin(unsigned long, uint8_t) {}
+  void end(void) {}
+  int available(void) { return 0; }
+  int read(void) { return -1; }
+  int peek(void) { return -1; }
+  size_t write(uint8_t c);
+  using Print::write;
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+/* The sketch, linked with trace_replay */
+void setup(void);
+void loop(void);
+
+#endif
@@ -0,0 +1,27 @@
+/*
+   SoftwareSerial for trace_replay: the ESP8266 at the other end is played back from a trace.
+*/
+#ifndef SoftwareSerial_h
+#define SoftwareSerial_h
+
+#include "Arduino.h"
+
+#define _SS_MAX_RX_BUFF 64
+
+class SoftwareSerial : public Stream {
+ public:
+  SoftwareSerial(uint8_t rx_pin, uint8_t tx_pin, bool inverse_logic = false);
+  void begin(long baud);
+  bool listen(void) { return true; }
+  bool isListening(void) { return true; }
+  bool stopListening(void) { return true; }
+  void end(void) {}
+  bool overflow(void);
+  int available(void);
+  int read(void);
+  int peek(void);
+  size_t write(uint8_t c);
+  using Print::write;
+};
+
+#endif
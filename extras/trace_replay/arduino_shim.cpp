@@ -0,0 +1,146 @@
+/*
+   String, Print and Stream of the Arduino API shim. The clock and the UART are in trace_replay.cpp.
+*/
+#include <stdio.h>
+#include "Arduino.h"
+
+std::string String::number(long v, unsigned char base)
+{
+  if (v < 0) {
+    return "-" + number((unsigned long)-v, base);
+  }
+  return number((unsigned long)v, base);
+}
+
+std::string String::number(unsigned long v, unsigned char base)
+{
+  char buf[33];
+  snprintf(buf, sizeof(buf), base == 16 ? "%lX" : "%lu", v);
+  return buf;
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+  String r;
+  if (from > to) {
+    unsigned int t = from;
+    from = to;
+    to = t;
+  }
+  if (from < m_s.size()) {
+    r.m_s = m_s.substr(from, to - from);
+  }
+  return r;
+}
+
+void String::trim(void)
+{
+  size_t first = m_s.find_first_not_of(" \t\r\n");
+  size_t last = m_s.find_last_not_of(" \t\r\n");
+  m_s = first == std::string::npos ? "" : m_s.substr(first, last - first + 1);
+}
+
+void String::toCharArray(char *buf, unsigned int size, unsigned int index) const
+{
+  if (size == 0) {
+    return;
+  }
+  strncpy(buf, index < m_s.size() ? m_s.c_str() + index : "", size - 1);
+  buf[size - 1] = '\0';
+}
+
+size_t Print::write(const uint8_t *buf, size_t size)
+{
+  size_t n = 0;
+  while (size--) {
+    n += write(*buf++);
+  }
+  return n;
+}
+
+size_t Print::print(double v, int digits)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", digits, v);
+  return write(buf);
+}
+
+int Stream::timedRead(void)
+{
+  unsigned long start = millis();
+  do {
+    int c = read();
+    if (c >= 0) {
+      return c;
+    }
+  } while (millis() - start < m_timeout);
+  return -1;
+}
+
+String Stream::readString(void)
+{
+  String r;
+  int c;
+  while ((c = timedRead()) >= 0) {
+    r += (char)c;
+  }
+  return r;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+  String r;
+  int c;
+  while ((c = timedRead()) >= 0 && c != terminator) {
+    r += (char)c;
+  }
+  return r;
+}
+
+size_t Stream::readBytes(char *buf, size_t size)
+{
+  size_t n = 0;
+  int c;
+  while (n < size && (c = timedRead()) >= 0) {
+    buf[n++] = c;
+  }
+  return n;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  fputc(c, stderr);
+  return 1;
+}
+
+HardwareSerial Serial;
+
+void pinMode(uint8_t, uint8_t)
+{
+
+}
+
+void digitalWrite(uint8_t, uint8_t)
+{
+
+}
+
+int digitalRead(uint8_t)
+{
+  return LOW;
+}
+
+long random(long max)
+{
+  return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+  return min + random(max - min);
+}
+
+void randomSeed(unsigned long seed)
+{
+  srand(seed);
+}
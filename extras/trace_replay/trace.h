@@ -0,0 +1,212 @@
+/*
+   Reading of the UART traces written by ESP8266::dumpTrace, shared by trace_profile and trace_replay.
+
+   File format(little endian):
+     "ESPT", version(1), 3 reserved bytes, entry count(uint32), entries dropped by the ring(uint32),
+     then one uint32 per entry: type(2 bits) | microseconds since the previous entry(22 bits) | byte.
+     Type 0 is a byte received from the ESP8266, 1 a byte sent to it, and 2 a pause too long for
+     22 bits, whose byte holds bits 22..29 of the pause.
+*/
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define TRACE_RX    0
+#define TRACE_TX    1
+#define TRACE_GAP   2
+
+struct TraceEvent {
+  uint64_t time;  /* microseconds since the oldest entry */
+  uint8_t type;   /* TRACE_RX or TRACE_TX */
+  uint8_t c;
+};
+
+/*
+ * One command and its response: the bytes sent in a row, and the bytes received until the next send.
+ * The first exchange has no tx and holds what was received before the first send.
+ */
+struct TraceExchange {
+  std::string tx;
+  uint64_t tx_start;
+  uint64_t tx_end;
+  std::string rx;
+  std::vector<uint64_t> rx_time;
+};
+
+static bool traceLoad(const char *path, std::vector<TraceEvent> &events, uint32_t &dropped)
+{
+  FILE *f = fopen(path, "rb");
+  uint8_t header[16];
+  uint8_t raw[4];
+  uint32_t count;
+  uint64_t now = 0;
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+  if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "ESPT", 4) != 0 || header[4] != 1) {
+    fprintf(stderr, "%s: not a version 1 ESP8266 trace\n", path);
+    fclose(f);
+    return false;
+  }
+  count = header[8] | header[9] << 8 | header[10] << 16 | (uint32_t)header[11] << 24;
+  dropped = header[12] | header[13] << 8 | header[14] << 16 | (uint32_t)header[15] << 24;
+  events.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t entry;
+    uint8_t type;
+    uint32_t delta;
+
+    if (fread(raw, 1, 4, f) != 4) {
+      fprintf(stderr, "%s: truncated after %u of %u entries\n", path, i, count);
+      break;
+    }
+    entry = raw[0] | raw[1] << 8 | raw[2] << 16 | (uint32_t)raw[3] << 24;
+    type = entry >> 30;
+    delta = (entry >> 8) & 0x3FFFFF;
+    if (type == TRACE_GAP) {
+      delta |= (entry & 0xFF) << 22;
+    }
+    /* the oldest entries' deltas point before the trace: start the clock at the first byte */
+    if (!events.empty()) {
+      now += delta;
+    }
+    if (type == TRACE_RX || type == TRACE_TX) {
+      TraceEvent event = {now, type, (uint8_t)(entry & 0xFF)};
+      events.push_back(event);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static std::vector<TraceExchange> traceSplit(const std::vector<TraceEvent> &events)
+{
+  std::vector<TraceExchange> exchanges(1);
+
+  exchanges[0].tx_start = exchanges[0].tx_end = 0;
+  for (size_t i = 0; i < events.size(); i++) {
+    const TraceEvent &e = events[i];
+    if (e.type == TRACE_TX) {
+      if (exchanges.size() == 1 || !exchanges.back().rx.empty()) {
+        TraceExchange next;
+        next.tx_start = e.time;
+        exchanges.push_back(next);
+      }
+      exchanges.back().tx += (char)e.c;
+      exchanges.back().tx_end = e.time;
+    } else {
+      exchanges.back().rx += (char)e.c;
+      exchanges.back().rx_time.push_back(e.time);
+    }
+  }
+  return exchanges;
+}
+
+/* "AT+CIPSEND=0,5\r\n" is profiled as "AT+CIPSEND", payload written after ">" as "(data)" */
+static std::string traceCommand(const std::string &tx)
+{
+  if (tx.compare(0, 2, "AT") != 0) {
+    return "(data)";
+  }
+  return tx.substr(0, tx.find_first_of("=?\r\n"));
+}
+
+/* Printable form of raw bytes */
+static std::string traceEscape(const std::string &s, size_t max = 60)
+{
+  std::string out;
+  char hex[8];
+  for (size_t i = 0; i < s.size() && out.size() < max; i++) {
+    unsigned char c = s[i];
+    if (c == '\r') {
+      out += "\\r";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c < 0x20 || c >= 0x7F) {
+      snprintf(hex, sizeof(hex), "\\x%02X", c);
+      out += hex;
+    } else {
+      out += (char)c;
+    }
+  }
+  return out;
+}
+
+/* Timing of one kind of command, all in microseconds */
+struct TraceStat {
+  unsigned long count = 0;
+  unsigned long answered = 0;            /* commands with a response */
+  uint64_t first_sum = 0, first_max = 0;  /* end of the command to the first response byte */
+  uint64_t done_sum = 0, done_max = 0;    /* end of the command to the last response byte */
+  uint64_t turn_sum = 0, turn_max = 0;    /* the last response byte to the next command */
+  unsigned long turns = 0;
+  uint64_t tx_bytes = 0, rx_bytes = 0;
+};
+
+static void traceAdd(uint64_t &sum, uint64_t &max, uint64_t value)
+{
+  sum += value;
+  if (value > max) {
+    max = value;
+  }
+}
+
+/*
+ * Profile the exchanges by command. turnaround, if given, replaces the recorded time from
+ * the end of each response to the next command(as measured by a replay).
+ */
+static std::map<std::string, TraceStat> traceProfile(const std::vector<TraceExchange> &exchanges,
+                                                     const std::vector<int64_t> *turnaround = NULL)
+{
+  std::map<std::string, TraceStat> stats;
+
+  for (size_t i = 1; i < exchanges.size(); i++) {
+    const TraceExchange &x = exchanges[i];
+    TraceStat &s = stats[traceCommand(x.tx)];
+    uint64_t last = x.rx.empty() ? x.tx_end : x.rx_time.back();
+
+    s.count++;
+    s.tx_bytes += x.tx.size();
+    s.rx_bytes += x.rx.size();
+    if (!x.rx.empty()) {
+      s.answered++;
+      traceAdd(s.first_sum, s.first_max, x.rx_time.front() - x.tx_end);
+      traceAdd(s.done_sum, s.done_max, last - x.tx_end);
+    }
+    if (turnaround != NULL) {
+      if (i < turnaround->size() && (*turnaround)[i] >= 0) {
+        traceAdd(s.turn_sum, s.turn_max, (*turnaround)[i]);
+        s.turns++;
+      }
+    } else if (i + 1 < exchanges.size()) {
+      traceAdd(s.turn_sum, s.turn_max, exchanges[i + 1].tx_start > last ? exchanges[i + 1].tx_start - last : 0);
+      s.turns++;
+    }
+  }
+  return stats;
+}
+
+static void tracePrintProfile(const std::map<std::string, TraceStat> &stats, const char *turn_title)
+{
+  printf("%-16s %5s %17s %17s %17s %8s %8s\n", "command", "count", "first byte ms",
+         "response ms", turn_title, "tx", "rx");
+  printf("%-16s %5s %8s %8s %8s %8s %8s %8s %8s %8s\n", "", "", "avg", "max", "avg", "max", "avg", "max", "bytes", "bytes");
+  for (std::map<std::string, TraceStat>::const_iterator it = stats.begin(); it != stats.end(); ++it) {
+    const TraceStat &s = it->second;
+    printf("%-16s %5lu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8llu %8llu\n", it->first.c_str(), s.count,
+           s.answered ? s.first_sum / 1000.0 / s.answered : 0.0, s.first_max / 1000.0,
+           s.answered ? s.done_sum / 1000.0 / s.answered : 0.0, s.done_max / 1000.0,
+           s.turns ? s.turn_sum / 1000.0 / s.turns : 0.0, s.turn_max / 1000.0,
+           (unsigned long long)s.tx_bytes, (unsigned long long)s.rx_bytes);
+  }
+}
+
+#endif /* #ifndef __TRACE_H__ */
@@ -0,0 +1,58 @@
+/*
+   Timing profile of a UART trace recorded by ESP8266::setTrace and written by ESP8266::dumpTrace.
+
+   Build:
+     g++ -O2 -o trace_profile trace_profile.cpp
+
+   Usage:
+     trace_profile [-v] trace.bin
+
+   Prints, per AT command, how long the ESP8266 took to start and to finish answering, and how
+   long the library took from the end of the answer to its next command(turnaround). A large
+   turnaround means the library waited for something which had already arrived, e.g. a fixed
+   delay or a timeout. -v also prints every exchange with its timing.
+*/
+#include <stdlib.h>
+#include "trace.h"
+
+int main(int argc, char **argv)
+{
+  std::vector<TraceEvent> events;
+  std::vector<TraceExchange> exchanges;
+  uint32_t dropped = 0;
+  bool verbose = false;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else {
+      path = argv[i];
+    }
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: %s [-v] trace.bin\n", argv[0]);
+    return 2;
+  }
+  if (!traceLoad(path, events, dropped)) {
+    return 1;
+  }
+  exchanges = traceSplit(events);
+
+  printf("%zu bytes over %.3f s, %u older entries dropped by the ring\n", events.size(),
+         events.empty() ? 0.0 : events.back().time / 1e6, dropped);
+  if (verbose) {
+    for (size_t i = 0; i < exchanges.size(); i++) {
+      const TraceExchange &x = exchanges[i];
+      if (!x.tx.empty()) {
+        printf("%10.3f ms > %s\n", x.tx_start / 1000.0, traceEscape(x.tx).c_str());
+      }
+      if (!x.rx.empty()) {
+        printf("%10.3f ms < %s\n", x.rx_time.front() / 1000.0, traceEscape(x.rx).c_str());
+      }
+    }
+  }
+  printf("\n");
+  tracePrintProfile(traceProfile(exchanges), "turnaround ms");
+  return 0;
+}
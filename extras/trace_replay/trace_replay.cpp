@@ -0,0 +1,267 @@
+/*
+   Replays a UART trace recorded by ESP8266::setTrace against the library code on a PC.
+
+   The sketch runs on a virtual clock with the ESP8266 played back from the trace: each time the
+   library has written the bytes of the next recorded command, the recorded response is fed to it
+   with the recorded timing. So latency problems and parser bugs seen in the field run again
+   under a debugger, and changes to the library can be checked against the same traffic.
+
+   Build(the sketch as a .cpp file which includes "Arduino.h"):
+     g++ -O2 -fpermissive -I. -I../.. -o replay trace_replay.cpp arduino_shim.cpp ../../ESP8266.cpp sketch.cpp
+
+   Usage:
+     replay [-s speed] trace.bin
+
+   speed 1 keeps the original timing, 10 runs ten times faster, 0(default) runs as fast as possible.
+   The report lists the commands which differ from the trace, SoftwareSerial overflows, and the
+   timing profile with the turnaround of the library in the replay next to the recorded one.
+*/
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include "Arduino.h"
+#include "SoftwareSerial.h"
+#include "trace.h"
+
+/* Time one millis()/micros() call takes, so wait loops always make progress */
+#define CLOCK_STEP_US   2
+
+/* Run on this long after the last response, to measure the final turnaround */
+#define GRACE_US        2000000ULL
+
+/* Give up when the library is this far past the end of the trace */
+#define LIMIT_US        60000000ULL
+
+struct Scheduled {
+  uint64_t time;
+  uint8_t c;
+};
+
+static std::vector<TraceExchange> g_exchanges;
+static size_t g_next = 1;                   /* the exchange whose command is expected */
+static std::string g_sent;                  /* what the library sent of it so far */
+static bool g_reported = false;             /* its difference was printed */
+static unsigned long g_mismatches = 0;
+static unsigned long g_extra = 0;           /* bytes sent after the end of the trace */
+static std::deque<Scheduled> g_pending;     /* responses on their way, in time order */
+static std::deque<uint8_t> g_fifo;          /* the SoftwareSerial RX buffer */
+static bool g_overflow = false;
+static unsigned long g_overflows = 0;
+static std::vector<uint64_t> g_lastRx;      /* replay time of the end of each response */
+static std::vector<int64_t> g_turnaround;   /* replay time from the end of a response to the next command */
+static uint64_t g_end = 0;                  /* replay time of the last response byte */
+static uint64_t g_limit = 0;
+static uint64_t g_now = 0;
+static double g_speed = 0;
+static long g_baud = 9600;
+static std::chrono::steady_clock::time_point g_wallStart;
+
+static void finish(int status)
+{
+  printf("\n%lu of %zu commands differ from the trace, %lu bytes sent past its end, %lu RX overflows\n",
+         g_mismatches, g_exchanges.size() - 1, g_extra, g_overflows);
+  if (g_next < g_exchanges.size()) {
+    printf("the sketch stopped following the trace at exchange %zu: %s\n", g_next,
+           traceEscape(g_exchanges[g_next].tx).c_str());
+  }
+  printf("\nrecorded:\n");
+  tracePrintProfile(traceProfile(g_exchanges), "turnaround ms");
+  printf("\nreplayed:\n");
+  tracePrintProfile(traceProfile(g_exchanges, &g_turnaround), "turnaround ms");
+  fflush(stdout);
+  exit(status);
+}
+
+static void advance(uint64_t us)
+{
+  g_now += us;
+  if (g_speed > 0) {
+    int64_t wall = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - g_wallStart).count();
+    int64_t ahead = (int64_t)(g_now / g_speed) - wall;
+    if (ahead > 2000) {
+      usleep(ahead);
+    }
+  }
+  if (g_next == g_exchanges.size() && g_pending.empty() && g_now > g_end + GRACE_US) {
+    finish(g_mismatches ? 1 : 0);
+  }
+  if (g_now > g_limit) {
+    finish(1);
+  }
+}
+
+static void deliver(void)
+{
+  while (!g_pending.empty() && g_pending.front().time <= g_now) {
+    if (g_fifo.size() < _SS_MAX_RX_BUFF) {
+      g_fifo.push_back(g_pending.front().c);
+    } else {
+      g_overflow = true;
+      g_overflows++;
+    }
+    g_pending.pop_front();
+  }
+}
+
+static void schedule(uint64_t time, uint8_t c)
+{
+  Scheduled s = {time, c};
+  std::deque<Scheduled>::iterator it = g_pending.end();
+  while (it != g_pending.begin() && (it - 1)->time > time) {
+    --it;
+  }
+  g_pending.insert(it, s);
+  if (time > g_end) {
+    g_end = time;
+  }
+}
+
+/* The library has sent a recorded command: play its response back */
+static void respond(size_t index, uint64_t origin)
+{
+  const TraceExchange &x = g_exchanges[index];
+  for (size_t i = 0; i < x.rx.size(); i++) {
+    schedule(g_now + (x.rx_time[i] - origin), x.rx[i]);
+  }
+  g_lastRx[index] = x.rx.empty() ? g_now : g_now + (x.rx_time.back() - origin);
+}
+
+unsigned long millis(void)
+{
+  advance(CLOCK_STEP_US);
+  return g_now / 1000;
+}
+
+unsigned long micros(void)
+{
+  advance(CLOCK_STEP_US);
+  return g_now;
+}
+
+void delay(unsigned long ms)
+{
+  advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  advance(us);
+}
+
+void yield(void)
+{
+  advance(CLOCK_STEP_US);
+}
+
+SoftwareSerial::SoftwareSerial(uint8_t, uint8_t, bool)
+{
+
+}
+
+void SoftwareSerial::begin(long baud)
+{
+  g_baud = baud;
+}
+
+bool SoftwareSerial::overflow(void)
+{
+  bool ret = g_overflow;
+  g_overflow = false;
+  return ret;
+}
+
+int SoftwareSerial::available(void)
+{
+  advance(1);
+  deliver();
+  return g_fifo.size();
+}
+
+int SoftwareSerial::read(void)
+{
+  int c;
+  deliver();
+  if (g_fifo.empty()) {
+    return -1;
+  }
+  c = g_fifo.front();
+  g_fifo.pop_front();
+  return c;
+}
+
+int SoftwareSerial::peek(void)
+{
+  deliver();
+  return g_fifo.empty() ? -1 : g_fifo.front();
+}
+
+size_t SoftwareSerial::write(uint8_t c)
+{
+  /* SoftwareSerial sends with interrupts off: 10 bits per byte */
+  advance(10000000ULL / g_baud);
+  if (g_next == g_exchanges.size()) {
+    g_extra++;
+    return 1;
+  }
+
+  const TraceExchange &x = g_exchanges[g_next];
+  if (g_sent.empty()) {
+    g_turnaround[g_next - 1] = g_next > 1 ? (int64_t)(g_now - g_lastRx[g_next - 1]) : -1;
+  }
+  g_sent += (char)c;
+  if (!g_reported && c != (uint8_t)x.tx[g_sent.size() - 1]) {
+    printf("exchange %zu: the library sent \"%s\", the trace has \"%s\"\n", g_next,
+           traceEscape(g_sent + "...").c_str(), traceEscape(x.tx).c_str());
+    g_reported = true;
+    g_mismatches++;
+  }
+  if (g_sent.size() == x.tx.size()) {
+    respond(g_next, x.tx_end);
+    g_next++;
+    g_sent.clear();
+    g_reported = false;
+  }
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<TraceEvent> events;
+  uint32_t dropped = 0;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      g_speed = atof(argv[++i]);
+    } else {
+      path = argv[i];
+    }
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: %s [-s speed] trace.bin\n", argv[0]);
+    return 2;
+  }
+  if (!traceLoad(path, events, dropped)) {
+    return 1;
+  }
+  if (dropped > 0) {
+    printf("the trace starts %u entries late: the first commands of the sketch are not in it\n", dropped);
+  }
+  g_exchanges = traceSplit(events);
+  g_lastRx.assign(g_exchanges.size(), 0);
+  g_turnaround.assign(g_exchanges.size(), -1);
+  g_limit = (events.empty() ? 0 : events.back().time) + LIMIT_US;
+  g_wallStart = std::chrono::steady_clock::now();
+
+  /* what the ESP8266 sent before the first command */
+  respond(0, 0);
+
+  setup();
+  for (;;) {
+    loop();
+    advance(CLOCK_STEP_US);
+  }
+  return 0;
+}